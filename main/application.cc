@@ -4,11 +4,10 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
-#include "mqtt_protocol.h"
-#include "websocket_protocol.h"
-#include "vertc_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
+#include "audio_buffer_pool.h"
+#include "task_placement.h"
 #include "assets/lang_config.h"
 
 #include <cstring>
@@ -20,43 +19,20 @@
 
 #define TAG "Application"
 
-
-static const char* const STATE_STRINGS[] = {
-    "unknown",
-    "starting",
-    "configuring",
-    "idle",
-    "connecting",
-    "listening",
-    "speaking",
-    "upgrading",
-    "activating",
-    "fatal_error",
-    "invalid_state"
-};
-
-Application::Application() {
+Application::Application()
+    : uplink_pacer_(OPUS_FRAME_DURATION_MS, CONFIG_UPLINK_PACING_CATCH_UP_PERCENT, CONFIG_UPLINK_PACING_MAX_DELAY_MS) {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 8);
-
-    esp_timer_create_args_t clock_timer_args = {
-        .callback = [](void* arg) {
-            Application* app = (Application*)arg;
-            app->OnClockTimer();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "clock_timer",
-        .skip_unhandled_events = true
-    };
-    esp_timer_create(&clock_timer_args, &clock_timer_handle_);
+    background_task_ = new BackgroundTask({kTaskBackgroundRealtime, kTaskBackgroundBulk});
+
+    clock_timer_ = TimerService::GetInstance().Create("clock_timer", CONFIG_HOUSEKEEPING_TIMER_SLACK_MS, [this]() {
+        OnClockTimer();
+    });
+
+    InitializeStateActions();
 }
 
 Application::~Application() {
-    if (clock_timer_handle_ != nullptr) {
-        esp_timer_stop(clock_timer_handle_);
-        esp_timer_delete(clock_timer_handle_);
-    }
+    TimerService::GetInstance().Delete(clock_timer_);
     if (background_task_ != nullptr) {
         delete background_task_;
     }
@@ -95,40 +71,42 @@ void Application::CheckNewVersion() {
             // Use main task to do the upgrade, not cancelable
             Schedule([this, display]() {
                 SetDeviceState(kDeviceStateUpgrading);
-                
-                display->SetIcon(FONT_AWESOME_DOWNLOAD);
-                std::string message = std::string(Lang::Strings::NEW_VERSION) + ota_.GetFirmwareVersion();
-                display->SetChatMessage("system", message.c_str());
-
-                auto& board = Board::GetInstance();
-                board.SetPowerSaveMode(false);
+                // Queued behind the state actions, the upgrade never returns to the main loop
+                Schedule([this, display]() {
+                    display->SetIcon(FONT_AWESOME_DOWNLOAD);
+                    std::string message = std::string(Lang::Strings::NEW_VERSION) + ota_.GetFirmwareVersion();
+                    display->SetChatMessage("system", message.c_str());
+
+                    auto& board = Board::GetInstance();
+                    board.SetPowerSaveMode(false);
 #if CONFIG_USE_WAKE_WORD_DETECT
-                wake_word_detect_.StopDetection();
+                    wake_word_detect_.StopDetection();
 #endif
-                // 预先关闭音频输出，避免升级过程有音频操作
-                auto codec = board.GetAudioCodec();
-                codec->EnableInput(false);
-                codec->EnableOutput(false);
-                {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    audio_decode_queue_.clear();
-                }
-                background_task_->WaitForCompletion();
-                delete background_task_;
-                background_task_ = nullptr;
-                vTaskDelay(pdMS_TO_TICKS(1000));
+                    // 预先关闭音频输出，避免升级过程有音频操作
+                    auto codec = board.GetAudioCodec();
+                    codec->EnableInput(false);
+                    codec->EnableOutput(false);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        ClearDecodeQueue();
+                    }
+                    background_task_->WaitForCompletion();
+                    delete background_task_;
+                    background_task_ = nullptr;
+                    vTaskDelay(pdMS_TO_TICKS(1000));
+
+                    ota_.StartUpgrade([display](int progress, size_t speed) {
+                        char buffer[64];
+                        snprintf(buffer, sizeof(buffer), "%d%% %zuKB/s", progress, speed / 1024);
+                        display->SetChatMessage("system", buffer);
+                    });
 
-                ota_.StartUpgrade([display](int progress, size_t speed) {
-                    char buffer[64];
-                    snprintf(buffer, sizeof(buffer), "%d%% %zuKB/s", progress, speed / 1024);
-                    display->SetChatMessage("system", buffer);
+                    // If upgrade success, the device will reboot and never reach here
+                    display->SetStatus(Lang::Strings::UPGRADE_FAILED);
+                    ESP_LOGI(TAG, "Firmware upgrade failed...");
+                    vTaskDelay(pdMS_TO_TICKS(3000));
+                    Reboot();
                 });
-
-                // If upgrade success, the device will reboot and never reach here
-                display->SetStatus(Lang::Strings::UPGRADE_FAILED);
-                ESP_LOGI(TAG, "Firmware upgrade failed...");
-                vTaskDelay(pdMS_TO_TICKS(3000));
-                Reboot();
             });
 
             return;
@@ -146,7 +124,7 @@ void Application::CheckNewVersion() {
 
             // Check again in 60 seconds or until the device is idle
             for (int i = 0; i < 60; ++i) {
-                if (device_state_ == kDeviceStateIdle) {
+                if (GetDeviceState() == kDeviceStateIdle) {
                     break;
                 }
                 vTaskDelay(pdMS_TO_TICKS(1000));
@@ -209,7 +187,7 @@ void Application::Alert(const char* status, const char* message, const char* emo
 }
 
 void Application::DismissAlert() {
-    if (device_state_ == kDeviceStateIdle) {
+    if (GetDeviceState() == kDeviceStateIdle) {
         auto display = Board::GetInstance().GetDisplay();
         display->SetStatus(Lang::Strings::STANDBY);
         display->SetEmotion("neutral");
@@ -238,8 +216,8 @@ void Application::PlaySound(const std::string_view& sound) {
     }
 }
 
-void Application::ToggleChatState() {
-    if (device_state_ == kDeviceStateActivating) {
+void Application::ToggleChatState(const std::string& wake_word) {
+    if (GetDeviceState() == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
         return;
     }
@@ -249,22 +227,29 @@ void Application::ToggleChatState() {
         return;
     }
 
-    if (device_state_ == kDeviceStateIdle) {
-        Schedule([this]() {
+    if (GetDeviceState() == kDeviceStateIdle) {
+        Schedule([this, wake_word]() {
             SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
-            }
+            // In a task of its own, the Connecting actions queued above run before the open blocks
+            Schedule([this, wake_word]() {
+                if (!OpenAudioChannel()) {
+                    return;
+                }
 
-            keep_listening_ = true;
-            protocol_->SendStartListening(kListeningModeAutoStop);
-            SetDeviceState(kDeviceStateListening);
+                keep_listening_ = true;
+                protocol_->SendStartListening(kListeningModeAutoStop);
+                // Only on the open channel, in the session of its hello
+                if (!wake_word.empty()) {
+                    protocol_->SendWakeWordDetected(wake_word);
+                }
+                SetDeviceState(kDeviceStateListening);
+            });
         });
-    } else if (device_state_ == kDeviceStateSpeaking) {
+    } else if (GetDeviceState() == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
-    } else if (device_state_ == kDeviceStateListening) {
+    } else if (GetDeviceState() == kDeviceStateListening) {
         Schedule([this]() {
             protocol_->CloseAudioChannel();
         });
@@ -272,7 +257,7 @@ void Application::ToggleChatState() {
 }
 
 void Application::StartListening() {
-    if (device_state_ == kDeviceStateActivating) {
+    if (GetDeviceState() == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
         return;
     }
@@ -283,18 +268,24 @@ void Application::StartListening() {
     }
     
     keep_listening_ = false;
-    if (device_state_ == kDeviceStateIdle) {
+    if (GetDeviceState() == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->SendStartListening(kListeningModeManualStop);
+                SetDeviceState(kDeviceStateListening);
+                return;
+            }
+            SetDeviceState(kDeviceStateConnecting);
+            // In a task of its own, the Connecting actions queued above run before the open blocks
+            Schedule([this]() {
+                if (!OpenAudioChannel()) {
                     return;
                 }
-            }
-            protocol_->SendStartListening(kListeningModeManualStop);
-            SetDeviceState(kDeviceStateListening);
+                protocol_->SendStartListening(kListeningModeManualStop);
+                SetDeviceState(kDeviceStateListening);
+            });
         });
-    } else if (device_state_ == kDeviceStateSpeaking) {
+    } else if (GetDeviceState() == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
             protocol_->SendStartListening(kListeningModeManualStop);
@@ -305,78 +296,58 @@ void Application::StartListening() {
 
 void Application::StopListening() {
     Schedule([this]() {
-        if (device_state_ == kDeviceStateListening) {
+        if (GetDeviceState() == kDeviceStateListening) {
+            uplink_pacer_.Flush();
             protocol_->SendStopListening();
             SetDeviceState(kDeviceStateIdle);
         }
     });
 }
 
-void Application::Start() {
-    auto& board = Board::GetInstance();
-    SetDeviceState(kDeviceStateStarting);
-
-    /* Setup the display */
-    auto display = board.GetDisplay();
-
-    /* Setup the audio codec */
-    auto codec = board.GetAudioCodec();
-    opus_decode_sample_rate_ = codec->output_sample_rate();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    // For ML307 boards, we use complexity 5 to save bandwidth
-    // For other boards, we use complexity 3 to save CPU
-    if (board.GetBoardType() == "ml307") {
-        ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
-    } else {
-        ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
-        opus_encoder_->SetComplexity(3);
+bool Application::OpenAudioChannel() {
+    auto start_time = esp_timer_get_time();
+    bool success = protocol_->OpenAudioChannel();
+    transport_manager_.OnOpenResult(success, (esp_timer_get_time() - start_time) / 1000);
+    if (!success && transport_manager_.NeedsFallback()) {
+        // Not inside this task, the caller still uses protocol_
+        Schedule([this]() {
+            SwitchTransport();
+        });
     }
+    return success;
+}
 
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+// Replaces the protocol in a main loop task of its own. The tasks the old
+// protocol has still queued find it gone and do nothing.
+void Application::SwitchTransport() {
+    if (!transport_manager_.NeedsFallback()) {
+        return;
     }
-    codec->OnInputReady([this, codec]() {
-        BaseType_t higher_priority_task_woken = pdFALSE;
-        xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
-        return higher_priority_task_woken == pdTRUE;
-    });
-    codec->OnOutputReady([this]() {
-        BaseType_t higher_priority_task_woken = pdFALSE;
-        xEventGroupSetBitsFromISR(event_group_, AUDIO_OUTPUT_READY_EVENT, &higher_priority_task_woken);
-        return higher_priority_task_woken == pdTRUE;
-    });
-    codec->Start();
-
-    /* Start the main loop */
-    xTaskCreate([](void* arg) {
-        Application* app = (Application*)arg;
-        app->MainLoop();
-        vTaskDelete(NULL);
-    }, "main_loop", 4096 * 2, this, 3, nullptr);
+    // Stop the old transport first, so that its tasks do not deliver more events
+    if (protocol_->IsAudioChannelOpened()) {
+        protocol_->CloseAudioChannel();
+    }
+    transport_manager_.Fallback();
+    protocol_ = transport_manager_.CreateProtocol();
+    InitializeProtocol();
+    protocol_->Start();
+}
 
-    /* Wait for the network to be ready */
-    board.StartNetwork();
+void Application::InitializeProtocol() {
+    auto& board = Board::GetInstance();
+    auto display = board.GetDisplay();
+    auto codec = board.GetAudioCodec();
 
-    // Initialize the protocol
-    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
-#ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
-    protocol_ = std::make_unique<WebsocketProtocol>();
-#elif defined CONFIG_CONNECTION_TYPE_MQTT_UDP
-    protocol_ = std::make_unique<MqttProtocol>();
-#elif defined CONFIG_CONNECTION_TYPE_VE_RTC
-    protocol_ = std::make_unique<VeRtcProtocol>();
-#endif
     protocol_->OnNetworkError([this](const std::string& message) {
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
     protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
         std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking) {
+        if (GetDeviceState() == kDeviceStateSpeaking) {
             audio_decode_queue_.emplace_back(std::move(data));
+        } else {
+            AudioBufferPool::GetInstance().Release(std::move(data));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -387,11 +358,13 @@ void Application::Start() {
         }
         SetDecodeSampleRate(protocol_->server_sample_rate());
         auto& thing_manager = iot::ThingManager::GetInstance();
+        auto iot_bytes = protocol_->iot_bytes_sent();
         protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
         std::string states;
         if (thing_manager.GetStatesJson(states, false)) {
             protocol_->SendIotStates(states);
         }
+        ESP_LOGI(TAG, "IoT sync sent %u bytes", (unsigned)(protocol_->iot_bytes_sent() - iot_bytes));
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
@@ -399,67 +372,149 @@ void Application::Start() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
+            uplink_pacer_.Clear();
+            uplink_pacer_.PrintStats();
+            transport_manager_.PrintStats();
+            state_machine_.PrintStats();
+            if (transport_manager_.NeedsFallback()) {
+                SwitchTransport();
+            }
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        background_task_->WaitForCompletion();
+    protocol_->OnIncomingMessage("tts", "start", [this](const IncomingMessage& message) {
+        Schedule([this]() {
+            aborted_ = false;
+            tts_turn_++;
+            if (GetDeviceState() == kDeviceStateIdle || GetDeviceState() == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+        });
+    });
+    protocol_->OnIncomingMessage("tts", "stop", [this](const IncomingMessage& message) {
+        Schedule([this]() {
+            if (GetDeviceState() == kDeviceStateSpeaking) {
+                if (!aborted_) {
+                    transport_manager_.OnSpeakingFinished(protocol_->GetNetworkQuality().received_packets);
+                }
+                // Let the queued audio play out without holding up the main loop
+                background_task_->Barrier([this, turn = tts_turn_]() {
+                    Schedule([this, turn]() {
+                        if (GetDeviceState() != kDeviceStateSpeaking || turn != tts_turn_) {
+                            return;
+                        }
                         if (keep_listening_) {
                             protocol_->SendStartListening(kListeningModeAutoStop);
                             SetDeviceState(kDeviceStateListening);
                         } else {
                             SetDeviceState(kDeviceStateIdle);
                         }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
                     });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (commands != NULL) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
-                }
+        });
+    });
+    protocol_->OnIncomingMessage("tts", "sentence_start", [this, display](const IncomingMessage& message) {
+        if (!message.text.empty()) {
+            ESP_LOGI(TAG, "<< %.*s", (int)message.text.size(), message.text.data());
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("assistant", text.c_str());
+            });
+        }
+    });
+    protocol_->OnIncomingMessage("stt", "", [this, display](const IncomingMessage& message) {
+        if (!message.text.empty()) {
+            ESP_LOGI(TAG, ">> %.*s", (int)message.text.size(), message.text.data());
+            Schedule([this, display, text = std::string(message.text)]() {
+                display->SetChatMessage("user", text.c_str());
+            });
+        }
+    });
+    protocol_->OnIncomingMessage("llm", "", [this, display](const IncomingMessage& message) {
+        if (!message.emotion.empty()) {
+            Schedule([this, display, emotion = std::string(message.emotion)]() {
+                display->SetEmotion(emotion.c_str());
+            });
+        }
+    });
+    protocol_->OnIncomingMessage("iot", "", [](const IncomingMessage& message) {
+        auto commands = cJSON_GetObjectItem(message.root, "commands");
+        if (commands != NULL) {
+            auto& thing_manager = iot::ThingManager::GetInstance();
+            for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
+                auto command = cJSON_GetArrayItem(commands, i);
+                thing_manager.Invoke(command);
             }
         }
     });
+}
+
+void Application::Start() {
+    auto& board = Board::GetInstance();
+    SetDeviceState(kDeviceStateStarting);
+    TaskPlacement::GetInstance().PrintReport();
+
+    /* Setup the display */
+    auto display = board.GetDisplay();
+
+    /* Setup the audio codec */
+    auto codec = board.GetAudioCodec();
+    opus_decode_sample_rate_ = codec->output_sample_rate();
+    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    // For ML307 boards, we use complexity 5 to save bandwidth
+    // For other boards, we use complexity 3 to save CPU
+    if (board.GetBoardType() == "ml307") {
+        ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
+        opus_encoder_->SetComplexity(5);
+    } else {
+        ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
+        opus_encoder_->SetComplexity(3);
+    }
+
+    uplink_pacer_.OnSend([this](const std::vector<uint8_t>& opus, uint32_t timestamp) {
+        return protocol_->SendAudio(opus, timestamp);
+    });
+#if CONFIG_UPLINK_PACING
+    // The modem buffers overrun when audio is sent in bursts
+    uplink_pacer_.SetEnabled(board.GetBoardType() == "ml307");
+#else
+    uplink_pacer_.SetEnabled(false);
+#endif
+
+    if (codec->input_sample_rate() != 16000) {
+        input_resampler_.Configure(codec->input_sample_rate(), 16000);
+        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+    }
+    codec->OnInputReady([this, codec]() {
+        uint32_t expected = 0, now = esp_timer_get_time();
+        input_ready_us_.compare_exchange_strong(expected, now != 0 ? now : 1);
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
+        return higher_priority_task_woken == pdTRUE;
+    });
+    codec->OnOutputReady([this]() {
+        uint32_t expected = 0, now = esp_timer_get_time();
+        output_ready_us_.compare_exchange_strong(expected, now != 0 ? now : 1);
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xEventGroupSetBitsFromISR(event_group_, AUDIO_OUTPUT_READY_EVENT, &higher_priority_task_woken);
+        return higher_priority_task_woken == pdTRUE;
+    });
+    codec->Start();
+
+    /* Start the main loop */
+    TaskPlacement::GetInstance().Create(kTaskMainLoop, [](void* arg) {
+        Application* app = (Application*)arg;
+        app->MainLoop();
+        vTaskDelete(NULL);
+    }, this);
+
+    /* Wait for the network to be ready */
+    board.StartNetwork();
+
+    // Initialize the protocol
+    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
+    protocol_ = transport_manager_.CreateProtocol();
+    InitializeProtocol();
     protocol_->Start();
 
     // Check for new firmware version or get the MQTT broker address
@@ -479,13 +534,14 @@ void Application::Start() {
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_.Initialize(codec->input_channels(), codec->input_reference());
     audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
+        uint32_t timestamp = esp_timer_get_time() / 1000;
+        background_task_->Schedule([this, timestamp, data = std::move(data)]() mutable {
+            opus_encoder_->Encode(std::move(data), [this, timestamp](std::vector<uint8_t>&& opus) {
+                Schedule([this, timestamp, opus = std::move(opus)]() mutable {
+                    uplink_pacer_.Push(std::move(opus), timestamp);
                 });
             });
-        });
+        }, kBackgroundLaneRealtime);
     });
 #endif
 
@@ -493,7 +549,7 @@ void Application::Start() {
     wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
     wake_word_detect_.OnVadStateChange([this](bool speaking) {
         Schedule([this, speaking]() {
-            if (device_state_ == kDeviceStateListening) {
+            if (GetDeviceState() == kDeviceStateListening) {
                 if (speaking) {
                     voice_detected_ = true;
                 } else {
@@ -506,29 +562,34 @@ void Application::Start() {
     });
 
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
-        Schedule([this, &wake_word]() {
-            if (device_state_ == kDeviceStateIdle) {
+        Schedule([this, wake_word]() {
+            if (GetDeviceState() == kDeviceStateIdle) {
                 SetDeviceState(kDeviceStateConnecting);
                 wake_word_detect_.EncodeWakeWordData();
 
-                if (!protocol_->OpenAudioChannel()) {
+                // In a task of its own, the Connecting actions queued above run before the open blocks
+                Schedule([this, wake_word]() {
+                    if (OpenAudioChannel()) {
+                        std::vector<uint8_t> opus;
+                        uint32_t timestamp;
+                        // Encode and send the wake word data to the server
+                        // The pre-roll is paced out behind the live audio instead of bursting
+                        while (wake_word_detect_.GetWakeWordOpus(opus, timestamp)) {
+                            uplink_pacer_.Push(std::move(opus), timestamp);
+                        }
+                        // Set the chat state to wake word detected
+                        protocol_->SendWakeWordDetected(wake_word);
+                        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+                        keep_listening_ = true;
+                        SetDeviceState(kDeviceStateIdle);
+                    }
+                    // Resume detection
                     wake_word_detect_.StartDetection();
-                    return;
-                }
-                
-                std::vector<uint8_t> opus;
-                // Encode and send the wake word data to the server
-                while (wake_word_detect_.GetWakeWordOpus(opus)) {
-                    protocol_->SendAudio(opus);
-                }
-                // Set the chat state to wake word detected
-                protocol_->SendWakeWordDetected(wake_word);
-                ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
-                keep_listening_ = true;
-                SetDeviceState(kDeviceStateIdle);
-            } else if (device_state_ == kDeviceStateSpeaking) {
+                });
+                return;
+            } else if (GetDeviceState() == kDeviceStateSpeaking) {
                 AbortSpeaking(kAbortReasonWakeWordDetected);
-            } else if (device_state_ == kDeviceStateActivating) {
+            } else if (GetDeviceState() == kDeviceStateActivating) {
                 SetDeviceState(kDeviceStateIdle);
             }
 
@@ -540,22 +601,38 @@ void Application::Start() {
 #endif
 
     SetDeviceState(kDeviceStateIdle);
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    TimerService::GetInstance().StartPeriodic(clock_timer_, 1000);
 }
 
 void Application::OnClockTimer() {
     clock_ticks_++;
+    main_loop_monitor_.CheckStall();
 
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintRealTimeStats(pdMS_TO_TICKS(1000));
+#if CONFIG_TASK_CPU_PROFILE
+        TaskPlacement::GetInstance().PrintCpuProfile();
+#endif
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
         ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        ESP_LOGI(TAG, "Main tasks: %lu, max depth %u/%u, spilled %lu, wait avg %lld us, max %lld us",
+            main_tasks_.pop_count(), (unsigned)main_tasks_.max_depth(), (unsigned)main_tasks_.capacity(),
+            main_tasks_.spill_count(), main_tasks_.average_wait_us(), main_tasks_.max_wait_us());
+        if (clock_ticks_ % 60 == 0) {
+            main_loop_monitor_.PrintStats();
+            TimerService::GetInstance().PrintStats();
+        }
+
+        if (protocol_ && protocol_->IsAudioChannelOpened()) {
+            auto quality = protocol_->GetNetworkQuality();
+            ESP_LOGI(TAG, "Network RTT: %d ms, jitter: %d ms, loss: %d%%", quality.rtt_ms, quality.jitter_ms, quality.loss_percent);
+        }
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
-            if (device_state_ == kDeviceStateIdle) {
+            if (GetDeviceState() == kDeviceStateIdle) {
                 Schedule([this]() {
                     // Set status to clock "HH:MM"
                     time_t now = time(NULL);
@@ -568,12 +645,15 @@ void Application::OnClockTimer() {
     }
 }
 
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
-    xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+void Application::OnScheduleQueueFull(const char* file, const char* caller, int line) {
+    ESP_LOGW(TAG, "Main task queue is full, queueing tasks on the heap from %s (%s:%d) (%lu so far)", caller,
+        MainLoopMonitor::BaseName(file), line, main_tasks_.spill_count());
+}
+
+// Time since the audio event was raised, and clears it for the next one
+static uint32_t EventLatency(std::atomic<uint32_t>& raised_us) {
+    uint32_t raised = raised_us.exchange(0);
+    return raised == 0 ? 0 : (uint32_t)esp_timer_get_time() - raised;
 }
 
 // The Main Loop controls the chat state and websocket connection
@@ -586,27 +666,41 @@ void Application::MainLoop() {
             pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & AUDIO_INPUT_READY_EVENT) {
+            main_loop_monitor_.Begin(kMainLoopEventAudioInput, EventLatency(input_ready_us_), nullptr, "InputAudio", 0);
             InputAudio();
+            main_loop_monitor_.End();
         }
         if (bits & AUDIO_OUTPUT_READY_EVENT) {
+            main_loop_monitor_.Begin(kMainLoopEventAudioOutput, EventLatency(output_ready_us_), nullptr, "OutputAudio", 0);
             OutputAudio();
+            main_loop_monitor_.End();
         }
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
+            // At most one queue worth per round, so audio events are not starved by tasks that schedule more tasks
+            ScheduledTask task;
+            int64_t wait_us;
+            size_t count = 0;
+            while (count < main_tasks_.capacity() && main_tasks_.TryPop(task, &wait_us)) {
+                main_loop_monitor_.Begin(kMainLoopEventSchedule, wait_us, task.file, task.caller, task.line);
+                task.callback();
+                main_loop_monitor_.End();
+                task.callback.Reset();
+                count++;
+            }
+            if (count == main_tasks_.capacity()) {
+                xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
             }
         }
     }
 }
 
-void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
+// Must be called with mutex_ held
+void Application::ClearDecodeQueue() {
+    auto& pool = AudioBufferPool::GetInstance();
+    for (auto& opus : audio_decode_queue_) {
+        pool.Release(std::move(opus));
+    }
     audio_decode_queue_.clear();
-    last_output_time_ = std::chrono::steady_clock::now();
 }
 
 void Application::OutputAudio() {
@@ -617,7 +711,7 @@ void Application::OutputAudio() {
     std::unique_lock<std::mutex> lock(mutex_);
     if (audio_decode_queue_.empty()) {
         // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
+        if (GetDeviceState() == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
             if (duration > max_silence_seconds) {
                 codec->EnableOutput(false);
@@ -626,8 +720,8 @@ void Application::OutputAudio() {
         return;
     }
 
-    if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
+    if (GetDeviceState() == kDeviceStateListening) {
+        ClearDecodeQueue();
         return;
     }
 
@@ -636,13 +730,18 @@ void Application::OutputAudio() {
     audio_decode_queue_.pop_front();
     lock.unlock();
 
-    background_task_->Schedule([this, codec, opus = std::move(opus)]() mutable {
-        if (aborted_) {
+    background_task_->ScheduleCancellable([this, codec, opus = std::move(opus)](bool cancelled) mutable {
+        if (cancelled || aborted_) {
+            AudioBufferPool::GetInstance().Release(std::move(opus));
             return;
         }
 
+        // The decoder takes its input as an rvalue, so it gets a copy and the pooled
+        // buffer goes straight back, whatever the decoder does with its argument
+        decode_packet_.assign(opus.begin(), opus.end());
+        AudioBufferPool::GetInstance().Release(std::move(opus));
         std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        if (!opus_decoder_->Decode(std::move(decode_packet_), pcm)) {
             return;
         }
 
@@ -655,7 +754,7 @@ void Application::OutputAudio() {
         }
         
         codec->OutputData(pcm);
-    });
+    }, kBackgroundLaneRealtime);
 }
 
 void Application::InputAudio() {
@@ -664,6 +763,12 @@ void Application::InputAudio() {
     if (!codec->InputData(data)) {
         return;
     }
+    if (discard_input_until_us_ != 0) {
+        if (esp_timer_get_time() < discard_input_until_us_) {
+            return;
+        }
+        discard_input_until_us_ = 0;
+    }
 
     if (codec->input_sample_rate() != 16000) {
         if (codec->input_channels() == 2) {
@@ -699,14 +804,16 @@ void Application::InputAudio() {
         audio_processor_.Input(data);
     }
 #else
-    if (device_state_ == kDeviceStateListening) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
+    if (GetDeviceState() == kDeviceStateListening) {
+        // Capture timestamp in milliseconds, carried with the encoded frame to the server
+        uint32_t timestamp = esp_timer_get_time() / 1000;
+        background_task_->Schedule([this, timestamp, data = std::move(data)]() mutable {
+            opus_encoder_->Encode(std::move(data), [this, timestamp](std::vector<uint8_t>&& opus) {
+                Schedule([this, timestamp, opus = std::move(opus)]() mutable {
+                    uplink_pacer_.Push(std::move(opus), timestamp);
                 });
             });
-        });
+        }, kBackgroundLaneRealtime);
     }
 #endif
 }
@@ -714,68 +821,95 @@ void Application::InputAudio() {
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    background_task_->Cancel(kBackgroundLaneRealtime);
     protocol_->SendAbortSpeaking(reason);
 }
 
 void Application::SetDeviceState(DeviceState state) {
-    if (device_state_ == state) {
-        return;
+    DeviceState previous_state;
+    int64_t requested_us;
+    {
+        // Incoming audio is queued under the same lock, so the packets of the new state are kept
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!state_machine_.Transition(state, previous_state, requested_us)) {
+            return;
+        }
+        if (state == kDeviceStateListening || state == kDeviceStateSpeaking) {
+            ClearDecodeQueue();
+            last_output_time_ = std::chrono::steady_clock::now();
+        }
     }
-    
+
     clock_ticks_ = 0;
-    auto previous_state = device_state_;
-    device_state_ = state;
-    ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    ESP_LOGI(TAG, "STATE: %s", DeviceStateMachine::GetStateName(state));
+    // Audio still queued for the previous state is dropped, not waited for
+    if (background_task_ != nullptr) {
+        background_task_->Cancel(kBackgroundLaneRealtime);
+    }
+    UpdateAudioPath(previous_state, state);
 
-    auto& board = Board::GetInstance();
-    auto codec = board.GetAudioCodec();
-    auto display = board.GetDisplay();
-    auto led = board.GetLed();
-    led->OnStateChanged();
-    switch (state) {
-        case kDeviceStateUnknown:
-        case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
+    // The display and LED follow on the main loop in transition order, the caller returns right away
+    auto run_actions = [this, previous_state, state, requested_us]() {
+        Board::GetInstance().GetLed()->OnStateChanged();
+        state_machine_.RunActions(previous_state, state, requested_us);
+    };
+    Schedule(std::move(run_actions));
+}
+
+// Runs with the state change, so that audio of the new state meets a reset decoder
+void Application::UpdateAudioPath(DeviceState previous, DeviceState state) {
 #if CONFIG_USE_AUDIO_PROCESSOR
-            audio_processor_.Stop();
+    if (previous == kDeviceStateListening) {
+        audio_processor_.Stop();
+    }
 #endif
-            break;
-        case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            break;
-        case kDeviceStateListening:
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("neutral");
-            ResetDecoder();
+    if (state != kDeviceStateListening && state != kDeviceStateSpeaking) {
+        return;
+    }
+    // The realtime lane owns the codec state, the reset waits behind any decode still running
+    background_task_->Schedule([this]() {
+        opus_decoder_->ResetState();
+    }, kBackgroundLaneRealtime);
+
+    if (state == kDeviceStateListening) {
+        background_task_->Schedule([this]() {
             opus_encoder_->ResetState();
+        }, kBackgroundLaneRealtime);
 #if CONFIG_USE_AUDIO_PROCESSOR
-            audio_processor_.Start();
+        audio_processor_.Start();
 #endif
-            UpdateIotStates();
-            if (previous_state == kDeviceStateSpeaking) {
-                // FIXME: Wait for the speaker to empty the buffer
-                vTaskDelay(pdMS_TO_TICKS(120));
-            }
-            break;
-        case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
-            ResetDecoder();
-            codec->EnableOutput(true);
-#if CONFIG_USE_AUDIO_PROCESSOR
-            audio_processor_.Stop();
-#endif
-            break;
-        default:
-            // Do nothing
-            break;
+        UpdateIotStates();
+        if (previous == kDeviceStateSpeaking) {
+            // The speaker is still emptying its buffer, keep it out of the microphone input
+            discard_input_until_us_ = esp_timer_get_time() + 120 * 1000;
+        }
+    } else {
+        Board::GetInstance().GetAudioCodec()->EnableOutput(true);
     }
 }
 
+void Application::InitializeStateActions() {
+    state_machine_.OnEnter(kDeviceStateIdle, [](DeviceState previous) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetStatus(Lang::Strings::STANDBY);
+        display->SetEmotion("neutral");
+    });
+    state_machine_.OnEnter(kDeviceStateConnecting, [](DeviceState previous) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetStatus(Lang::Strings::CONNECTING);
+        display->SetEmotion("neutral");
+        display->SetChatMessage("system", "");
+    });
+    state_machine_.OnEnter(kDeviceStateListening, [](DeviceState previous) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetStatus(Lang::Strings::LISTENING);
+        display->SetEmotion("neutral");
+    });
+    state_machine_.OnEnter(kDeviceStateSpeaking, [](DeviceState previous) {
+        Board::GetInstance().GetDisplay()->SetStatus(Lang::Strings::SPEAKING);
+    });
+}
+
 void Application::SetDecodeSampleRate(int sample_rate) {
     if (opus_decode_sample_rate_ == sample_rate) {
         return;
@@ -806,18 +940,13 @@ void Application::Reboot() {
 }
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
-    if (device_state_ == kDeviceStateIdle) {
-        ToggleChatState();
-        Schedule([this, wake_word]() {
-            if (protocol_) {
-                protocol_->SendWakeWordDetected(wake_word); 
-            }
-        }); 
-    } else if (device_state_ == kDeviceStateSpeaking) {
+    if (GetDeviceState() == kDeviceStateIdle) {
+        ToggleChatState(wake_word);
+    } else if (GetDeviceState() == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
-    } else if (device_state_ == kDeviceStateListening) {   
+    } else if (GetDeviceState() == kDeviceStateListening) {   
         Schedule([this]() {
             if (protocol_) {
                 protocol_->CloseAudioChannel();
@@ -827,7 +956,7 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
 }
 
 bool Application::CanEnterSleepMode() {
-    if (device_state_ != kDeviceStateIdle) {
+    if (GetDeviceState() != kDeviceStateIdle) {
         return false;
     }
 
@@ -15,8 +15,14 @@
 #include <opus_resampler.h>
 
 #include "protocol.h"
+#include "transport_manager.h"
+#include "uplink_pacer.h"
+#include "task_queue.h"
 #include "ota.h"
 #include "background_task.h"
+#include "device_state_machine.h"
+#include "main_loop_monitor.h"
+#include "timer_service.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
@@ -29,21 +35,21 @@
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
 #define AUDIO_OUTPUT_READY_EVENT (1 << 2)
 
-enum DeviceState {
-    kDeviceStateUnknown,
-    kDeviceStateStarting,
-    kDeviceStateWifiConfiguring,
-    kDeviceStateIdle,
-    kDeviceStateConnecting,
-    kDeviceStateListening,
-    kDeviceStateSpeaking,
-    kDeviceStateUpgrading,
-    kDeviceStateActivating,
-    kDeviceStateFatalError
-};
-
 #define OPUS_FRAME_DURATION_MS 60
 
+// Enough inline storage for a task capturing this, a pointer and a string
+#define MAIN_TASK_STORAGE_SIZE (2 * sizeof(void*) + sizeof(std::string))
+using MainTask = InlineTask<MAIN_TASK_STORAGE_SIZE>;
+
+struct ScheduledTask {
+    MainTask callback;
+    // Where the task was scheduled from, for the main loop monitor. Inside a
+    // lambda the function is "operator()", the file and line tell them apart.
+    const char* file;
+    const char* caller;
+    int line;
+};
+
 class Application {
 public:
     static Application& GetInstance() {
@@ -55,14 +61,28 @@ public:
     Application& operator=(const Application&) = delete;
 
     void Start();
-    DeviceState GetDeviceState() const { return device_state_; }
+    DeviceState GetDeviceState() const { return state_machine_.state(); }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // Runs the callback on the main loop, callbacks are never dropped. The
+    // callback is moved into the queue without allocating unless the queue is
+    // full. The file, caller and line default to the call site.
+    template <typename F>
+    void Schedule(F&& callback, const char* file = __builtin_FILE(), const char* caller = __builtin_FUNCTION(),
+        int line = __builtin_LINE()) {
+        if (main_tasks_.Push(ScheduledTask{MainTask(std::forward<F>(callback)), file, caller, line})) {
+            OnScheduleQueueFull(file, caller, line);
+        }
+        xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+    }
+    // The state and the audio path change right away on the calling task, the
+    // display and LED follow in a main loop task; work that blocks afterwards
+    // belongs in a later task
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
     void AbortSpeaking(AbortReason reason);
-    void ToggleChatState();
+    // With a wake word, it is sent once the audio channel is open
+    void ToggleChatState(const std::string& wake_word = "");
     void StartListening();
     void StopListening();
     void UpdateIotStates();
@@ -83,15 +103,25 @@ private:
 #endif
     Ota ota_;
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    SpillingTaskQueue<ScheduledTask, CONFIG_MAIN_TASK_QUEUE_SIZE> main_tasks_;
+    MainLoopMonitor main_loop_monitor_;
+    // When the audio events were raised, 0 if none is pending. Low 32 bits of the timer, set from the ISR
+    std::atomic<uint32_t> input_ready_us_{0};
+    std::atomic<uint32_t> output_ready_us_{0};
     std::unique_ptr<Protocol> protocol_;
+    TransportManager transport_manager_;
+    UplinkPacer uplink_pacer_;
     EventGroupHandle_t event_group_ = nullptr;
-    esp_timer_handle_t clock_timer_handle_ = nullptr;
-    volatile DeviceState device_state_ = kDeviceStateUnknown;
+    TimerId clock_timer_ = 0;
+    DeviceStateMachine state_machine_;
     bool keep_listening_ = false;
     bool aborted_ = false;
+    // Counts tts starts, a deferred tts stop is ignored if a new turn began meanwhile
+    uint32_t tts_turn_ = 0;
     bool voice_detected_ = false;
     int clock_ticks_ = 0;
+    // Microphone input before this time is thrown away
+    int64_t discard_input_until_us_ = 0;
 
     // Audio encode / decode
     BackgroundTask* background_task_ = nullptr;
@@ -100,6 +130,8 @@ private:
 
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // Input of the opus decoder, only used on the realtime background lane
+    std::vector<uint8_t> decode_packet_;
 
     int opus_decode_sample_rate_ = -1;
     OpusResampler input_resampler_;
@@ -109,11 +141,17 @@ private:
     void MainLoop();
     void InputAudio();
     void OutputAudio();
-    void ResetDecoder();
+    void UpdateAudioPath(DeviceState previous, DeviceState state);
+    void ClearDecodeQueue();
     void SetDecodeSampleRate(int sample_rate);
     void CheckNewVersion();
     void ShowActivationCode();
     void OnClockTimer();
+    void OnScheduleQueueFull(const char* file, const char* caller, int line);
+    void InitializeProtocol();
+    void InitializeStateActions();
+    bool OpenAudioChannel();
+    void SwitchTransport();
 };
 
 #endif // _APPLICATION_H_
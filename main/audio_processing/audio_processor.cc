@@ -1,4 +1,5 @@
 #include "audio_processor.h"
+#include "task_placement.h"
 #include <esp_log.h>
 
 #define PROCESSOR_RUNNING 0x01
@@ -15,6 +16,8 @@ void AudioProcessor::Initialize(int channels, bool reference) {
     reference_ = reference;
     int ref_num = reference_ ? 1 : 0;
 
+    // AFE creates its own tasks and only takes a core and a priority
+    auto& afe_placement = TaskPlacement::GetInstance().Get(kTaskAfe);
     afe_config_t afe_config = {
         .aec_init = false,
         .se_init = true,
@@ -28,8 +31,8 @@ void AudioProcessor::Initialize(int channels, bool reference) {
         .wakenet_model_name_2 = NULL,
         .wakenet_mode = DET_MODE_90,
         .afe_mode = SR_MODE_HIGH_PERF,
-        .afe_perferred_core = 1,
-        .afe_perferred_priority = 1,
+        .afe_perferred_core = afe_placement.core < 0 ? 0 : afe_placement.core,
+        .afe_perferred_priority = (int)afe_placement.priority,
         .afe_ringbuf_size = 50,
         .memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM,
         .afe_linear_gain = 1.0,
@@ -49,11 +52,11 @@ void AudioProcessor::Initialize(int channels, bool reference) {
 
     afe_communication_data_ = esp_afe_vc_v1.create_from_config(&afe_config);
     
-    xTaskCreate([](void* arg) {
+    TaskPlacement::GetInstance().Create(kTaskAudioCommunication, [](void* arg) {
         auto this_ = (AudioProcessor*)arg;
         this_->AudioProcessorTask();
         vTaskDelete(NULL);
-    }, "audio_communication", 4096 * 2, this, 2, NULL);
+    }, this);
 }
 
 AudioProcessor::~AudioProcessor() {
@@ -1,10 +1,12 @@
 #include "wake_word_detect.h"
 #include "application.h"
+#include "task_placement.h"
 
 #include <esp_log.h>
 #include <model_path.h>
 #include <arpa/inet.h>
 #include <sstream>
+#include <algorithm>
 
 #define DETECTION_RUNNING_EVENT 1
 
@@ -50,6 +52,8 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
         }
     }
 
+    // AFE creates its own tasks and only takes a core and a priority
+    auto& afe_placement = TaskPlacement::GetInstance().Get(kTaskAfe);
     afe_config_t afe_config = {
         .aec_init = reference_,
         .se_init = true,
@@ -63,8 +67,8 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
         .wakenet_model_name_2 = NULL,
         .wakenet_mode = DET_MODE_90,
         .afe_mode = SR_MODE_HIGH_PERF,
-        .afe_perferred_core = 1,
-        .afe_perferred_priority = 1,
+        .afe_perferred_core = afe_placement.core < 0 ? 0 : afe_placement.core,
+        .afe_perferred_priority = (int)afe_placement.priority,
         .afe_ringbuf_size = 50,
         .memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM,
         .afe_linear_gain = 1.0,
@@ -84,11 +88,11 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
 
     afe_detection_data_ = esp_afe_sr_v1.create_from_config(&afe_config);
 
-    xTaskCreate([](void* arg) {
+    TaskPlacement::GetInstance().Create(kTaskAudioDetection, [](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096 * 2, this, 2, nullptr);
+    }, this);
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -163,6 +167,7 @@ void WakeWordDetect::AudioDetectionTask() {
 void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
     // store audio data to wake_word_pcm_
     wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
+    wake_word_end_time_us_ = esp_timer_get_time();
     // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
     while (wake_word_pcm_.size() > 2000 / 32) {
         wake_word_pcm_.pop_front();
@@ -171,10 +176,18 @@ void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
 
 void WakeWordDetect::EncodeWakeWordData() {
     wake_word_opus_.clear();
+    wake_word_samples_ = 0;
+    for (auto& pcm : wake_word_pcm_) {
+        wake_word_samples_ += pcm.size();
+    }
+    wake_word_frames_read_ = 0;
+    auto& placement = TaskPlacement::GetInstance();
+    auto& entry = placement.Get(kTaskWakeWordEncode);
     if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(entry.stack_size,
+            entry.stack_in_psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL);
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
+    wake_word_encode_task_ = xTaskCreateStaticPinnedToCore([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         {
             auto start_time = esp_timer_get_time();
@@ -199,15 +212,21 @@ void WakeWordDetect::EncodeWakeWordData() {
             this_->wake_word_cv_.notify_all();
         }
         vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+    }, entry.name, entry.stack_size, this, entry.priority, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_,
+        placement.GetCore(kTaskWakeWordEncode));
 }
 
-bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus, uint32_t& timestamp) {
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
     wake_word_cv_.wait(lock, [this]() {
         return !wake_word_opus_.empty();
     });
     opus.swap(wake_word_opus_.front());
     wake_word_opus_.pop_front();
+
+    // The buffered audio is 16 kHz mono and ends at the newest stored chunk
+    const size_t frame_samples = 16000 / 1000 * OPUS_FRAME_DURATION_MS;
+    size_t end_samples = std::min(++wake_word_frames_read_ * frame_samples, wake_word_samples_);
+    timestamp = (wake_word_end_time_us_ - (int64_t)(wake_word_samples_ - end_samples) * 1000 / 16) / 1000;
     return !opus.empty();
 }
@@ -29,7 +29,8 @@ public:
     void StopDetection();
     bool IsDetectionRunning();
     void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    // Timestamp is the capture time of the end of the frame, in milliseconds like the live audio
+    bool GetWakeWordOpus(std::vector<uint8_t>& opus, uint32_t& timestamp);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
@@ -50,6 +51,10 @@ private:
     StackType_t* wake_word_encode_task_stack_ = nullptr;
     std::list<std::vector<int16_t>> wake_word_pcm_;
     std::list<std::vector<uint8_t>> wake_word_opus_;
+    // When the newest stored chunk was captured, and how much audio is being encoded
+    int64_t wake_word_end_time_us_ = 0;
+    size_t wake_word_samples_ = 0;
+    size_t wake_word_frames_read_ = 0;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
@@ -5,59 +5,140 @@
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 2, &background_task_handle_);
+BackgroundTask::BackgroundTask(std::initializer_list<TaskRole> lanes) {
+    int index = 0;
+    for (auto role : lanes) {
+        if (index >= kBackgroundLaneCount) {
+            ESP_LOGW(TAG, "Too many lanes, ignoring %s", TaskPlacement::GetInstance().Get(role).name);
+            break;
+        }
+        lanes_[index].owner = this;
+        lanes_[index].role = role;
+        lanes_[index].name = TaskPlacement::GetInstance().Get(role).name;
+        index++;
+    }
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    for (auto& lane : lanes_) {
+        if (lane.handle != nullptr) {
+            vTaskDelete(lane.handle);
+        }
     }
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
+void BackgroundTask::Schedule(std::function<void()> callback, BackgroundLane lane) {
+    Enqueue(Job{std::move(callback), nullptr, 0}, lane);
+}
+
+void BackgroundTask::ScheduleCancellable(std::function<void(bool cancelled)> callback, BackgroundLane lane) {
+    Enqueue(Job{nullptr, std::move(callback), lanes_[lane].epoch.load()}, lane);
+}
+
+void BackgroundTask::Enqueue(Job&& job, BackgroundLane index) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (active_tasks_ >= 30) {
+    auto& lane = lanes_[index];
+    if (lane.handle == nullptr) {
+        TaskPlacement::GetInstance().Create(lane.role, [](void* arg) {
+            Lane* lane = (Lane*)arg;
+            lane->owner->LaneLoop(*lane);
+        }, &lane, &lane.handle);
+    }
+
+    uint64_t pending = lane.scheduled - lane.finished;
+    if (pending >= 30) {
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         if (free_sram < 10000) {
-            ESP_LOGW(TAG, "active_tasks_ == %u, free_sram == %u", active_tasks_.load(), free_sram);
+            ESP_LOGW(TAG, "%s: pending jobs == %u, free_sram == %u", lane.name, (unsigned)pending, free_sram);
         }
     }
-    active_tasks_++;
-    main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (main_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
+    lane.scheduled++;
+    lane.jobs.emplace_back(std::move(job));
+    lane.condition.notify_one();
+}
+
+void BackgroundTask::Cancel(BackgroundLane lane) {
+    lanes_[lane].epoch++;
+}
+
+void BackgroundTask::Barrier(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!IsIdle()) {
+            PendingBarrier barrier;
+            for (int i = 0; i < kBackgroundLaneCount; i++) {
+                barrier.targets[i] = lanes_[i].scheduled;
             }
+            barrier.callback = std::move(callback);
+            barriers_.emplace_back(std::move(barrier));
+            return;
         }
-    });
-    condition_variable_.notify_all();
+    }
+    callback();
+}
+
+bool BackgroundTask::IsIdle() const {
+    for (auto& lane : lanes_) {
+        if (lane.finished != lane.scheduled) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void BackgroundTask::WaitForCompletion() {
     std::unique_lock<std::mutex> lock(mutex_);
-    condition_variable_.wait(lock, [this]() {
-        return main_tasks_.empty() && active_tasks_ == 0;
+    idle_.wait(lock, [this]() {
+        return IsIdle();
     });
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+void BackgroundTask::LaneLoop(Lane& lane) {
+    ESP_LOGI(TAG, "%s started", lane.name);
+    std::list<Job> jobs;
+    std::list<PendingBarrier> ready;
     while (true) {
         std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !main_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(main_tasks_);
+        lane.condition.wait(lock, [&lane]() { return !lane.jobs.empty(); });
+        jobs.splice(jobs.end(), lane.jobs);
         lock.unlock();
 
-        for (auto& task : tasks) {
-            task();
+        while (!jobs.empty()) {
+            auto& job = jobs.front();
+            if (job.cancellable) {
+                job.cancellable(job.epoch != lane.epoch.load());
+            } else {
+                job.callback();
+            }
+            jobs.pop_front();
+
+            lock.lock();
+            lane.finished++;
+            for (auto it = barriers_.begin(); it != barriers_.end();) {
+                bool reached = true;
+                for (int i = 0; i < kBackgroundLaneCount; i++) {
+                    if (lanes_[i].finished < it->targets[i]) {
+                        reached = false;
+                        break;
+                    }
+                }
+                if (reached) {
+                    auto next = std::next(it);
+                    ready.splice(ready.end(), barriers_, it);
+                    it = next;
+                } else {
+                    ++it;
+                }
+            }
+            if (IsIdle()) {
+                idle_.notify_all();
+            }
+            lock.unlock();
+
+            for (auto& barrier : ready) {
+                barrier.callback();
+            }
+            ready.clear();
         }
     }
 }
@@ -7,23 +7,71 @@
 #include <list>
 #include <condition_variable>
 #include <atomic>
+#include <functional>
+#include <initializer_list>
 
+#include "task_placement.h"
+
+enum BackgroundLane {
+    kBackgroundLaneRealtime,    // Audio encode and decode
+    kBackgroundLaneBulk,        // Everything that may take a while without hurting playback
+    kBackgroundLaneCount
+};
+
+// Runs jobs off the main loop. Each lane has its own task, so a long bulk
+// job never delays audio, and jobs of the same lane run in FIFO order. A lane
+// task is only created when the first job is scheduled on it.
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    // One task role from the placement table per lane, in BackgroundLane order
+    BackgroundTask(std::initializer_list<TaskRole> lanes);
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
+    void Schedule(std::function<void()> callback, BackgroundLane lane = kBackgroundLaneBulk);
+    // The job is tagged with the current epoch of the lane. If Cancel() moves
+    // the epoch on before the job runs, it is called with cancelled = true so it
+    // can give back what it holds without doing the work.
+    void ScheduleCancellable(std::function<void(bool cancelled)> callback, BackgroundLane lane);
+    void Cancel(BackgroundLane lane);
+    // Calls callback once every job scheduled so far, on all lanes, has
+    // finished. It runs on the lane task that finishes last, or right away if
+    // nothing is pending. Does not block the caller.
+    void Barrier(std::function<void()> callback);
+    // Blocks until all lanes are idle, must not be called from a job
     void WaitForCompletion();
 
 private:
+    struct Job {
+        std::function<void()> callback;
+        std::function<void(bool cancelled)> cancellable;
+        uint32_t epoch;
+    };
+
+    struct Lane {
+        BackgroundTask* owner = nullptr;
+        TaskRole role;
+        const char* name = nullptr;
+        TaskHandle_t handle = nullptr;
+        std::list<Job> jobs;
+        std::condition_variable condition;
+        std::atomic<uint32_t> epoch{0};
+        uint64_t scheduled = 0;
+        uint64_t finished = 0;
+    };
+
+    struct PendingBarrier {
+        uint64_t targets[kBackgroundLaneCount];
+        std::function<void()> callback;
+    };
+
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
-    std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
-    std::atomic<size_t> active_tasks_{0};
+    std::condition_variable idle_;
+    Lane lanes_[kBackgroundLaneCount];
+    std::list<PendingBarrier> barriers_;
 
-    void BackgroundTaskLoop();
+    void Enqueue(Job&& job, BackgroundLane lane);
+    bool IsIdle() const;
+    void LaneLoop(Lane& lane);
 };
 
 #endif
@@ -0,0 +1,96 @@
+#include "cached_tls_transport.h"
+#include "tls_session_cache.h"
+#include "dns_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_crt_bundle.h>
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+#define TAG "CachedTlsTransport"
+
+CachedTlsTransport::CachedTlsTransport() {
+}
+
+CachedTlsTransport::~CachedTlsTransport() {
+    Disconnect();
+}
+
+bool CachedTlsTransport::Connect(const char* host, int port) {
+    auto address = DnsCache::GetInstance().Resolve(host);
+    if (address.empty()) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host);
+        return false;
+    }
+
+    auto& cache = TlsSessionCache::GetInstance();
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    // Connect by address but verify the certificate and send SNI for the host name
+    cfg.common_name = host;
+    // Held until the handshake is done, esp_tls copies it into the connection
+    auto session = cache.Apply(host, port, cfg);
+    bool with_session = session != nullptr;
+
+    auto start_time = esp_timer_get_time();
+    tls_client_ = esp_tls_init();
+    if (tls_client_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize TLS");
+        return false;
+    }
+    if (esp_tls_conn_new_sync(address.c_str(), address.size(), port, &cfg, tls_client_) != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+        if (with_session) {
+            // The server may have rejected the ticket, start over with a full handshake next time
+            cache.Invalidate(host, port);
+        }
+        return false;
+    }
+
+    int64_t duration_ms = (esp_timer_get_time() - start_time) / 1000;
+    cache.RecordHandshake(with_session, duration_ms);
+    cache.Update(host, port, tls_client_);
+    ESP_LOGI(TAG, "Connected to %s:%d in %lld ms (%s)", host, port, duration_ms, with_session ? "resumed" : "full");
+    cache.PrintStats();
+
+    connected_ = true;
+    return true;
+}
+
+void CachedTlsTransport::Disconnect() {
+    if (tls_client_ != nullptr) {
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+    }
+    connected_ = false;
+}
+
+int CachedTlsTransport::Send(const char* data, size_t length) {
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        int ret = esp_tls_conn_write(tls_client_, data + total_sent, length - total_sent);
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Send failed: %d", ret);
+            connected_ = false;
+            return ret;
+        }
+        total_sent += ret;
+    }
+    return total_sent;
+}
+
+int CachedTlsTransport::Receive(char* buffer, size_t bufferSize) {
+    int ret = esp_tls_conn_read(tls_client_, buffer, bufferSize);
+    if (ret <= 0) {
+        connected_ = false;
+    }
+    return ret;
+}
+
+#endif // CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
@@ -0,0 +1,27 @@
+#ifndef CACHED_TLS_TRANSPORT_H
+#define CACHED_TLS_TRANSPORT_H
+
+#include <transport.h>
+#include <esp_tls.h>
+
+#include <string>
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+// TLS transport that resumes sessions from TlsSessionCache
+class CachedTlsTransport : public Transport {
+public:
+    CachedTlsTransport();
+    ~CachedTlsTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t bufferSize) override;
+
+private:
+    esp_tls_t* tls_client_ = nullptr;
+};
+
+#endif // CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#endif // CACHED_TLS_TRANSPORT_H
@@ -0,0 +1,139 @@
+#include "dns_cache.h"
+#include "settings.h"
+#include "task_placement.h"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
+
+#define TAG "DnsCache"
+
+// NVS keys are limited to 15 characters, so hosts are stored by hash
+static std::string MakeSettingsKey(const std::string& host) {
+    uint32_t hash = 2166136261u;
+    for (char c : host) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    char key[16];
+    snprintf(key, sizeof(key), "h%08lx", (unsigned long)hash);
+    return key;
+}
+
+static bool IsAddress(const std::string& host) {
+    struct in_addr addr;
+    return inet_aton(host.c_str(), &addr) != 0;
+}
+
+bool DnsCache::Lookup(const std::string& host, std::string& address) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    int err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+    if (err != 0 || result == nullptr) {
+        ESP_LOGW(TAG, "Failed to resolve %s: %d", host.c_str(), err);
+        return false;
+    }
+    char buffer[INET_ADDRSTRLEN];
+    auto sin = (struct sockaddr_in*)result->ai_addr;
+    inet_ntop(AF_INET, &sin->sin_addr, buffer, sizeof(buffer));
+    freeaddrinfo(result);
+    address = buffer;
+    return true;
+}
+
+void DnsCache::Store(const std::string& host, const std::string& address) {
+    std::string previous;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = entries_[host];
+        previous = entry.address;
+        entry.address = address;
+        entry.expire_time = std::chrono::steady_clock::now() + std::chrono::seconds(CONFIG_DNS_CACHE_TTL_SECONDS);
+        entry.refreshing = false;
+    }
+    // Only write flash when the address actually changed
+    if (previous != address) {
+        Settings settings("dns", true);
+        if (settings.GetString(MakeSettingsKey(host)) != address) {
+            settings.SetString(MakeSettingsKey(host), address);
+        }
+    }
+}
+
+void DnsCache::StartRefresh(const std::string& host) {
+    auto arg = new std::string(host);
+    bool created = TaskPlacement::GetInstance().Create(kTaskDnsRefresh, [](void* arg) {
+        auto host = (std::string*)arg;
+        auto& cache = DnsCache::GetInstance();
+        std::string address;
+        if (cache.Lookup(*host, address)) {
+            cache.Store(*host, address);
+        } else {
+            std::lock_guard<std::mutex> lock(cache.mutex_);
+            cache.entries_[*host].refreshing = false;
+        }
+        delete host;
+        vTaskDelete(NULL);
+    }, arg);
+    if (!created) {
+        delete arg;
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[host].refreshing = false;
+    }
+}
+
+std::string DnsCache::Resolve(const std::string& host) {
+    if (IsAddress(host)) {
+        return host;
+    }
+
+    std::string cached;
+    bool refresh = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(host);
+        if (it != entries_.end()) {
+            auto now = std::chrono::steady_clock::now();
+            auto remaining = it->second.expire_time - now;
+            if (remaining > std::chrono::seconds(0)) {
+                cached = it->second.address;
+                // Refresh during the last quarter of the TTL so the entry never expires in use
+                if (remaining < std::chrono::seconds(CONFIG_DNS_CACHE_TTL_SECONDS / 4) && !it->second.refreshing) {
+                    it->second.refreshing = true;
+                    refresh = true;
+                }
+            }
+        }
+    }
+    if (!cached.empty()) {
+        if (refresh) {
+            StartRefresh(host);
+        }
+        return cached;
+    }
+
+    std::string address;
+    if (Lookup(host, address)) {
+        Store(host, address);
+        return address;
+    }
+
+    // DNS failed, fall back to the last address that worked
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(host);
+        if (it != entries_.end() && !it->second.address.empty()) {
+            ESP_LOGW(TAG, "Using stale address %s for %s", it->second.address.c_str(), host.c_str());
+            return it->second.address;
+        }
+    }
+    Settings settings("dns");
+    address = settings.GetString(MakeSettingsKey(host));
+    if (!address.empty()) {
+        ESP_LOGW(TAG, "Using saved address %s for %s", address.c_str(), host.c_str());
+    }
+    return address;
+}
@@ -0,0 +1,41 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <chrono>
+
+// Resolved IPv4 addresses of the servers we connect to. Entries are
+// refreshed in the background before they expire, and the last known good
+// address is kept in NVS as a fallback for when DNS fails.
+class DnsCache {
+public:
+    static DnsCache& GetInstance() {
+        static DnsCache instance;
+        return instance;
+    }
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    // Returns the address of host, or an empty string if it cannot be resolved
+    std::string Resolve(const std::string& host);
+
+private:
+    DnsCache() = default;
+
+    struct Entry {
+        std::string address;
+        std::chrono::steady_clock::time_point expire_time;
+        bool refreshing = false;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+
+    bool Lookup(const std::string& host, std::string& address);
+    void Store(const std::string& host, const std::string& address);
+    void StartRefresh(const std::string& host);
+};
+
+#endif // DNS_CACHE_H
@@ -2,9 +2,10 @@
 
 #include <functional>
 
-#include <esp_timer.h>
 #include <esp_pm.h>
 
+#include "timer_service.h"
+
 class PowerSaveTimer {
 public:
     PowerSaveTimer(int cpu_max_freq, int seconds_to_sleep = 20, int seconds_to_shutdown = -1);
@@ -19,7 +20,7 @@ public:
 private:
     void PowerSaveCheck();
 
-    esp_timer_handle_t power_save_timer_ = nullptr;
+    TimerId power_save_timer_ = 0;
     bool enabled_ = false;
     bool in_sleep_mode_ = false;
     int ticks_ = 0;
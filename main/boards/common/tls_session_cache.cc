@@ -0,0 +1,66 @@
+#include "tls_session_cache.h"
+
+#include <esp_log.h>
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+#define TAG "TlsSessionCache"
+
+static std::string MakeKey(const std::string& host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+std::shared_ptr<esp_tls_client_session_t> TlsSessionCache::Apply(const std::string& host, int port, esp_tls_cfg_t& cfg) {
+    // Copy the reference under the lock, so the session outlives a concurrent replacement
+    std::shared_ptr<esp_tls_client_session_t> session;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(MakeKey(host, port));
+        if (it == sessions_.end()) {
+            return nullptr;
+        }
+        session = it->second;
+    }
+    cfg.client_session = session.get();
+    return session;
+}
+
+void TlsSessionCache::Update(const std::string& host, int port, esp_tls_t* tls) {
+    auto session = esp_tls_get_client_session(tls);
+    if (session == nullptr) {
+        return;
+    }
+
+    // The old session is freed once the last connection using it is done with it
+    std::shared_ptr<esp_tls_client_session_t> entry(session, esp_tls_free_client_session);
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_[MakeKey(host, port)] = std::move(entry);
+}
+
+void TlsSessionCache::Invalidate(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(MakeKey(host, port));
+}
+
+void TlsSessionCache::RecordHandshake(bool with_session, int64_t duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (with_session) {
+        resumed_handshakes_++;
+        resumed_handshake_ms_ += duration_ms;
+    } else {
+        full_handshakes_++;
+        full_handshake_ms_ += duration_ms;
+    }
+}
+
+void TlsSessionCache::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t saved_ms = 0;
+    if (full_handshakes_ > 0 && resumed_handshakes_ > 0) {
+        saved_ms = full_handshake_ms_ / full_handshakes_ * resumed_handshakes_ - resumed_handshake_ms_;
+    }
+    ESP_LOGI(TAG, "Handshakes full: %lu, resumed: %lu, saved %lld ms",
+        full_handshakes_, resumed_handshakes_, saved_ms);
+}
+
+#endif // CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
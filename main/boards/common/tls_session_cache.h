@@ -0,0 +1,49 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <esp_tls.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+// TLS sessions of the servers we talked to, keyed by host:port, so the next
+// connection can resume instead of doing a full handshake
+class TlsSessionCache {
+public:
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    // Configure cfg to resume the cached session of the server, returns the session if one
+    // was found. The caller keeps it until the handshake is done, a concurrent Update or
+    // Invalidate only drops the cache's reference.
+    std::shared_ptr<esp_tls_client_session_t> Apply(const std::string& host, int port, esp_tls_cfg_t& cfg);
+    // Store the session of a connected client, replacing the old one
+    void Update(const std::string& host, int port, esp_tls_t* tls);
+    // Drop the session after a failed resumption attempt
+    void Invalidate(const std::string& host, int port);
+    void RecordHandshake(bool with_session, int64_t duration_ms);
+    void PrintStats();
+
+private:
+    TlsSessionCache() = default;
+    ~TlsSessionCache() = default;
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<esp_tls_client_session_t>> sessions_;
+
+    uint32_t full_handshakes_ = 0;
+    uint32_t resumed_handshakes_ = 0;
+    int64_t full_handshake_ms_ = 0;
+    int64_t resumed_handshake_ms_ = 0;
+};
+
+#endif // CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#endif // TLS_SESSION_CACHE_H
@@ -6,6 +6,7 @@
 #include "font_awesome_symbols.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "cached_tls_transport.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -127,10 +128,15 @@ Http* WifiBoard::CreateHttp() {
 }
 
 WebSocket* WifiBoard::CreateWebSocket() {
-#ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
-    std::string url = CONFIG_WEBSOCKET_URL;
+#ifndef CONFIG_CONNECTION_TYPE_VE_RTC
+    Settings settings("websocket", false);
+    std::string url = settings.GetString("url", CONFIG_WEBSOCKET_URL);
     if (url.find("wss://") == 0) {
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        return new WebSocket(new CachedTlsTransport());
+#else
         return new WebSocket(new TlsTransport());
+#endif
     } else {
         return new WebSocket(new TcpTransport());
     }
@@ -0,0 +1,136 @@
+#include "device_state_machine.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "StateMachine"
+
+static const char* const STATE_STRINGS[] = {
+    "unknown",
+    "starting",
+    "configuring",
+    "idle",
+    "connecting",
+    "listening",
+    "speaking",
+    "upgrading",
+    "activating",
+    "fatal_error",
+    "invalid_state"
+};
+
+struct DeviceStateTransition {
+    DeviceState from;
+    DeviceState to;
+};
+
+// Every transition the firmware makes, anything else is rejected. Any state
+// may still fail into kDeviceStateFatalError.
+static const DeviceStateTransition TRANSITIONS[] = {
+    {kDeviceStateUnknown, kDeviceStateStarting},
+    {kDeviceStateStarting, kDeviceStateWifiConfiguring},
+    {kDeviceStateStarting, kDeviceStateIdle},
+    {kDeviceStateStarting, kDeviceStateActivating},
+    {kDeviceStateStarting, kDeviceStateUpgrading},
+    {kDeviceStateIdle, kDeviceStateConnecting},
+    {kDeviceStateIdle, kDeviceStateListening},
+    {kDeviceStateIdle, kDeviceStateSpeaking},
+    {kDeviceStateIdle, kDeviceStateActivating},
+    {kDeviceStateIdle, kDeviceStateUpgrading},
+    {kDeviceStateConnecting, kDeviceStateIdle},
+    {kDeviceStateConnecting, kDeviceStateListening},
+    {kDeviceStateListening, kDeviceStateIdle},
+    {kDeviceStateListening, kDeviceStateSpeaking},
+    {kDeviceStateSpeaking, kDeviceStateIdle},
+    {kDeviceStateSpeaking, kDeviceStateListening},
+    {kDeviceStateActivating, kDeviceStateIdle},
+    {kDeviceStateActivating, kDeviceStateUpgrading},
+};
+
+#define TRANSITION_COUNT (sizeof(TRANSITIONS) / sizeof(TRANSITIONS[0]))
+
+DeviceStateMachine::DeviceStateMachine() : stats_(TRANSITION_COUNT) {
+}
+
+const char* DeviceStateMachine::GetStateName(DeviceState state) {
+    if (state < 0 || state >= kDeviceStateCount) {
+        return STATE_STRINGS[kDeviceStateCount];
+    }
+    return STATE_STRINGS[state];
+}
+
+int DeviceStateMachine::FindTransition(DeviceState from, DeviceState to) {
+    for (size_t i = 0; i < TRANSITION_COUNT; i++) {
+        if (TRANSITIONS[i].from == from && TRANSITIONS[i].to == to) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool DeviceStateMachine::Transition(DeviceState state, DeviceState& previous, int64_t& requested_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    previous = state_;
+    if (previous == state) {
+        return false;
+    }
+    if (state != kDeviceStateFatalError && FindTransition(previous, state) < 0) {
+        rejected_count_++;
+        ESP_LOGW(TAG, "Rejected transition %s -> %s", GetStateName(previous), GetStateName(state));
+        return false;
+    }
+
+    requested_us = esp_timer_get_time();
+    state_ = state;
+    history_[history_count_ % (sizeof(history_) / sizeof(history_[0]))] = {previous, state, requested_us};
+    history_count_++;
+    return true;
+}
+
+void DeviceStateMachine::RunActions(DeviceState previous, DeviceState state, int64_t requested_us) {
+    int64_t start_time = esp_timer_get_time();
+    if (exit_actions_[previous]) {
+        exit_actions_[previous](state);
+    }
+    if (entry_actions_[state]) {
+        entry_actions_[state](previous);
+    }
+    int64_t end_time = esp_timer_get_time();
+
+    int index = FindTransition(previous, state);
+    if (index < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& stats = stats_[index];
+    uint32_t wait_us = start_time - requested_us;
+    uint32_t run_us = end_time - start_time;
+    stats.count++;
+    stats.total_wait_us += wait_us;
+    stats.total_run_us += run_us;
+    stats.max_wait_us = std::max(stats.max_wait_us, wait_us);
+    stats.max_run_us = std::max(stats.max_run_us, run_us);
+}
+
+void DeviceStateMachine::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "State: %s, rejected transitions: %lu", GetStateName(state_), (unsigned long)rejected_count_);
+    for (size_t i = 0; i < TRANSITION_COUNT; i++) {
+        auto& stats = stats_[i];
+        if (stats.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "  %s -> %s: %lu times, wait avg %lld max %lu us, run avg %lld max %lu us",
+            GetStateName(TRANSITIONS[i].from), GetStateName(TRANSITIONS[i].to), (unsigned long)stats.count,
+            stats.total_wait_us / stats.count, (unsigned long)stats.max_wait_us,
+            stats.total_run_us / stats.count, (unsigned long)stats.max_run_us);
+    }
+
+    const size_t history_size = sizeof(history_) / sizeof(history_[0]);
+    size_t first = history_count_ > history_size ? history_count_ - history_size : 0;
+    for (size_t i = first; i < history_count_; i++) {
+        auto& entry = history_[i % history_size];
+        ESP_LOGI(TAG, "  at %lld ms: %s -> %s", entry.time_us / 1000, GetStateName(entry.from), GetStateName(entry.to));
+    }
+}
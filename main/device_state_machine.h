@@ -0,0 +1,74 @@
+#ifndef DEVICE_STATE_MACHINE_H
+#define DEVICE_STATE_MACHINE_H
+
+#include <functional>
+#include <mutex>
+#include <cstdint>
+#include <vector>
+
+enum DeviceState {
+    kDeviceStateUnknown,
+    kDeviceStateStarting,
+    kDeviceStateWifiConfiguring,
+    kDeviceStateIdle,
+    kDeviceStateConnecting,
+    kDeviceStateListening,
+    kDeviceStateSpeaking,
+    kDeviceStateUpgrading,
+    kDeviceStateActivating,
+    kDeviceStateFatalError,
+    kDeviceStateCount
+};
+
+// Device state with an explicit table of legal transitions. Changing the
+// state is cheap and can be done from any task; the exit and entry actions
+// run later, through RunActions, on the task the owner picks.
+class DeviceStateMachine {
+public:
+    using Action = std::function<void(DeviceState other)>;
+
+    DeviceStateMachine();
+    static const char* GetStateName(DeviceState state);
+
+    DeviceState state() const { return state_; }
+    // Moves to the new state if the table allows it. On success previous is
+    // the state that was left and the transition is timestamped.
+    bool Transition(DeviceState state, DeviceState& previous, int64_t& requested_us);
+
+    // The exit action gets the next state, the entry action the previous one
+    void OnExit(DeviceState state, Action action) { exit_actions_[state] = std::move(action); }
+    void OnEnter(DeviceState state, Action action) { entry_actions_[state] = std::move(action); }
+    // Runs the actions of one transition and accounts how long it waited and ran
+    void RunActions(DeviceState previous, DeviceState state, int64_t requested_us);
+
+    void PrintStats();
+
+private:
+    struct TransitionStats {
+        uint32_t count;
+        uint32_t max_wait_us;
+        uint32_t max_run_us;
+        int64_t total_wait_us;
+        int64_t total_run_us;
+    };
+
+    struct HistoryEntry {
+        DeviceState from;
+        DeviceState to;
+        int64_t time_us;
+    };
+
+    volatile DeviceState state_ = kDeviceStateUnknown;
+    std::mutex mutex_;
+    Action exit_actions_[kDeviceStateCount];
+    Action entry_actions_[kDeviceStateCount];
+    // Indexed like the transition table
+    std::vector<TransitionStats> stats_;
+    uint32_t rejected_count_ = 0;
+    HistoryEntry history_[8] = {};
+    size_t history_count_ = 0;
+
+    static int FindTransition(DeviceState from, DeviceState to);
+};
+
+#endif // DEVICE_STATE_MACHINE_H
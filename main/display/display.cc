@@ -15,34 +15,19 @@
 #define TAG "Display"
 
 Display::Display() {
+    auto& timer_service = TimerService::GetInstance();
     // Notification timer
-    esp_timer_create_args_t notification_timer_args = {
-        .callback = [](void *arg) {
-            Display *display = static_cast<Display*>(arg);
-            DisplayLockGuard lock(display);
-            lv_obj_add_flag(display->notification_label_, LV_OBJ_FLAG_HIDDEN);
-            lv_obj_clear_flag(display->status_label_, LV_OBJ_FLAG_HIDDEN);
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "notification_timer",
-        .skip_unhandled_events = false,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
+    notification_timer_ = timer_service.Create("notification_timer", CONFIG_HOUSEKEEPING_TIMER_SLACK_MS, [this]() {
+        DisplayLockGuard lock(this);
+        lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_clear_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
+    });
 
     // Update display timer
-    esp_timer_create_args_t update_display_timer_args = {
-        .callback = [](void *arg) {
-            Display *display = static_cast<Display*>(arg);
-            display->Update();
-        },
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "display_update_timer",
-        .skip_unhandled_events = true,
-    };
-    ESP_ERROR_CHECK(esp_timer_create(&update_display_timer_args, &update_timer_));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(update_timer_, 1000000));
+    update_timer_ = timer_service.Create("display_update_timer", CONFIG_HOUSEKEEPING_TIMER_SLACK_MS, [this]() {
+        Update();
+    });
+    timer_service.StartPeriodic(update_timer_, 1000);
 
     // Create a power management lock
     auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
@@ -54,14 +39,8 @@ Display::Display() {
 }
 
 Display::~Display() {
-    if (notification_timer_ != nullptr) {
-        esp_timer_stop(notification_timer_);
-        esp_timer_delete(notification_timer_);
-    }
-    if (update_timer_ != nullptr) {
-        esp_timer_stop(update_timer_);
-        esp_timer_delete(update_timer_);
-    }
+    TimerService::GetInstance().Delete(notification_timer_);
+    TimerService::GetInstance().Delete(update_timer_);
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -100,8 +79,7 @@ void Display::ShowNotification(const char* notification, int duration_ms) {
     lv_obj_clear_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
 
-    esp_timer_stop(notification_timer_);
-    ESP_ERROR_CHECK(esp_timer_start_once(notification_timer_, duration_ms * 1000));
+    TimerService::GetInstance().StartOnce(notification_timer_, duration_ms);
 }
 
 void Display::Update() {
@@ -8,6 +8,8 @@
 
 #include <string>
 
+#include "timer_service.h"
+
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
     const lv_font_t* icon_font = nullptr;
@@ -49,8 +51,8 @@ protected:
     const char* network_icon_ = nullptr;
     bool muted_ = false;
 
-    esp_timer_handle_t notification_timer_ = nullptr;
-    esp_timer_handle_t update_timer_ = nullptr;
+    TimerId notification_timer_ = 0;
+    TimerId update_timer_ = 0;
 
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
@@ -9,6 +9,7 @@
 #include <cstring>
 
 #include "board.h"
+#include "task_placement.h"
 
 #define TAG "LcdDisplay"
 
@@ -35,8 +36,13 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
+    auto& placement = TaskPlacement::GetInstance().Get(kTaskDisplay);
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    port_cfg.task_priority = placement.priority;
+    port_cfg.task_affinity = placement.core;
+    if (placement.stack_size != 0) {
+        port_cfg.task_stack = placement.stack_size;
+    }
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD screen");
@@ -98,8 +104,13 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
+    auto& placement = TaskPlacement::GetInstance().Get(kTaskDisplay);
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    port_cfg.task_priority = placement.priority;
+    port_cfg.task_affinity = placement.core;
+    if (placement.stack_size != 0) {
+        port_cfg.task_stack = placement.stack_size;
+    }
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD screen");
@@ -1,6 +1,7 @@
 #include "oled_display.h"
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
+#include "task_placement.h"
 
 #include <string>
 #include <algorithm>
@@ -20,8 +21,13 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
     height_ = height;
 
     ESP_LOGI(TAG, "Initialize LVGL");
+    auto& placement = TaskPlacement::GetInstance().Get(kTaskDisplay);
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    port_cfg.task_priority = placement.priority;
+    port_cfg.task_affinity = placement.core;
+    if (placement.stack_size != 0) {
+        port_cfg.task_stack = placement.stack_size;
+    }
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD screen");
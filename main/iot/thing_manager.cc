@@ -10,16 +10,13 @@ void ThingManager::AddThing(Thing* thing) {
     things_.push_back(thing);
 }
 
-std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
+std::vector<std::string> ThingManager::GetDescriptorsJson() {
+    std::vector<std::string> descriptors;
+    descriptors.reserve(things_.size());
     for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+        descriptors.push_back(thing->GetDescriptorJson());
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
-    }
-    json_str += "]";
-    return json_str;
+    return descriptors;
 }
 
 bool ThingManager::GetStatesJson(std::string& json, bool delta) {
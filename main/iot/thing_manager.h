@@ -24,7 +24,8 @@ public:
 
     void AddThing(Thing* thing);
 
-    std::string GetDescriptorsJson();
+    // One descriptor JSON per thing
+    std::vector<std::string> GetDescriptorsJson();
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
 
@@ -0,0 +1,153 @@
+#include "main_loop_monitor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#define TAG "MainLoopMonitor"
+
+static const char* const EVENT_NAMES[] = {"schedule", "input", "output"};
+
+// The last bucket catches everything above the previous bound
+static const uint32_t BUCKET_BOUNDS_US[LATENCY_HISTOGRAM_BUCKETS] = {
+    100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, UINT32_MAX
+};
+
+void LatencyHistogram::Add(uint32_t us) {
+    int bucket = 0;
+    while (us > BUCKET_BOUNDS_US[bucket]) {
+        bucket++;
+    }
+    buckets[bucket]++;
+    count++;
+    max_us = std::max(max_us, us);
+}
+
+uint32_t LatencyHistogram::Percentile(int percent) const {
+    uint64_t target = ((uint64_t)count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return std::min(BUCKET_BOUNDS_US[i], max_us);
+        }
+    }
+    return max_us;
+}
+
+const char* MainLoopMonitor::BaseName(const char* path) {
+    if (path == nullptr) {
+        return "?";
+    }
+    const char* slash = strrchr(path, '/');
+    return slash != nullptr ? slash + 1 : path;
+}
+
+void MainLoopMonitor::FormatSource(char* buffer, size_t size, const char* file, const char* caller, int line) {
+    if (file == nullptr) {
+        snprintf(buffer, size, "%s", caller != nullptr ? caller : "?");
+    } else {
+        snprintf(buffer, size, "%s (%s:%d)", caller != nullptr ? caller : "?", BaseName(file), line);
+    }
+}
+
+void MainLoopMonitor::Begin(MainLoopEvent event, uint32_t latency_us, const char* file, const char* caller, int line) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        latency_[event].Add(latency_us);
+    }
+    current_event_ = event;
+    current_file_ = file;
+    current_line_ = line;
+    current_caller_ = caller;
+    stall_reported_ = false;
+    // 0 means idle, so never store it as a start time
+    uint32_t now = esp_timer_get_time();
+    current_start_us_ = now != 0 ? now : 1;
+}
+
+void MainLoopMonitor::End() {
+    uint32_t run_us = (uint32_t)esp_timer_get_time() - current_start_us_;
+    current_start_us_ = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    run_time_[current_event_].Add(run_us);
+    if (run_us > CONFIG_MAIN_LOOP_TASK_BUDGET_MS * 1000) {
+        AddOffender(current_file_, current_caller_, current_line_, run_us);
+        char source[64];
+        FormatSource(source, sizeof(source), current_file_, current_caller_, current_line_);
+        ESP_LOGW(TAG, "%s handler from %s ran %lu ms, budget %d ms", EVENT_NAMES[current_event_], source,
+            (unsigned long)(run_us / 1000), CONFIG_MAIN_LOOP_TASK_BUDGET_MS);
+    }
+}
+
+void MainLoopMonitor::AddOffender(const char* file, const char* caller, int line, uint32_t us) {
+    Offender* slot = nullptr;
+    for (auto& offender : offenders_) {
+        if (offender.count != 0 && offender.file == file && offender.caller == caller && offender.line == line) {
+            slot = &offender;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        // Keep the worst ones, the mildest offender gives way
+        slot = std::min_element(std::begin(offenders_), std::end(offenders_), [](const Offender& a, const Offender& b) {
+            return a.max_us < b.max_us;
+        });
+        if (slot->count != 0 && slot->max_us >= us) {
+            return;
+        }
+        *slot = {file, caller, line, 0, 0};
+    }
+    slot->count++;
+    slot->max_us = std::max(slot->max_us, us);
+}
+
+void MainLoopMonitor::CheckStall() {
+    uint32_t start_us = current_start_us_;
+    if (start_us == 0 || stall_reported_) {
+        return;
+    }
+    uint32_t running_us = (uint32_t)esp_timer_get_time() - start_us;
+    if (running_us < CONFIG_MAIN_LOOP_STALL_MS * 1000) {
+        return;
+    }
+    stall_reported_ = true;
+    char source[64];
+    FormatSource(source, sizeof(source), current_file_, current_caller_, current_line_);
+    ESP_LOGW(TAG, "Main loop stalled for %lu ms in the handler from %s, audio is not serviced",
+        (unsigned long)(running_us / 1000), source);
+}
+
+void MainLoopMonitor::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kMainLoopEventCount; i++) {
+        auto& latency = latency_[i];
+        auto& run_time = run_time_[i];
+        if (latency.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-8s %6lu handled, latency p50 %lu p99 %lu max %lu us, run p50 %lu p99 %lu max %lu us",
+            EVENT_NAMES[i], (unsigned long)latency.count,
+            (unsigned long)latency.Percentile(50), (unsigned long)latency.Percentile(99), (unsigned long)latency.max_us,
+            (unsigned long)run_time.Percentile(50), (unsigned long)run_time.Percentile(99), (unsigned long)run_time.max_us);
+
+        char buffer[LATENCY_HISTOGRAM_BUCKETS * 12];
+        int length = 0;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            length += snprintf(buffer + length, sizeof(buffer) - length, " %lu", (unsigned long)run_time.buckets[j]);
+        }
+        ESP_LOGI(TAG, "%-8s run time buckets (<=0.1/0.5/1/5/10/50/100/500/1000/>1000 ms):%s", EVENT_NAMES[i], buffer);
+    }
+    for (auto& offender : offenders_) {
+        if (offender.count != 0) {
+            char source[64];
+            FormatSource(source, sizeof(source), offender.file, offender.caller, offender.line);
+            ESP_LOGI(TAG, "Over budget: %s %lu times, max %lu ms", source, (unsigned long)offender.count,
+                (unsigned long)(offender.max_us / 1000));
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef MAIN_LOOP_MONITOR_H
+#define MAIN_LOOP_MONITOR_H
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+enum MainLoopEvent {
+    kMainLoopEventSchedule,
+    kMainLoopEventAudioInput,
+    kMainLoopEventAudioOutput,
+    kMainLoopEventCount
+};
+
+#define LATENCY_HISTOGRAM_BUCKETS 10
+
+struct LatencyHistogram {
+    uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+    uint32_t count = 0;
+    uint32_t max_us = 0;
+
+    void Add(uint32_t us);
+    // Upper bound of the bucket holding the given percentile, in microseconds
+    uint32_t Percentile(int percent) const;
+};
+
+// Times every handler of the main loop: how long it waited after its event
+// was raised and how long it ran. Handlers over budget are logged with the
+// place they were scheduled from, and a handler that is still running past
+// the stall limit is reported while it blocks.
+class MainLoopMonitor {
+public:
+    // Called on the main loop around every handler. file is null for the
+    // handlers that are not scheduled tasks, caller is then their name.
+    void Begin(MainLoopEvent event, uint32_t latency_us, const char* file, const char* caller, int line);
+    void End();
+
+    // Called from another task, warns once per handler that blocks the loop
+    void CheckStall();
+    void PrintStats();
+
+    // __builtin_FILE() gives the path the compiler was given, only the file name is logged
+    static const char* BaseName(const char* path);
+
+private:
+    struct Offender {
+        const char* file;
+        const char* caller;
+        int line;
+        uint32_t count;
+        uint32_t max_us;
+    };
+
+    std::mutex mutex_;
+    LatencyHistogram latency_[kMainLoopEventCount];
+    LatencyHistogram run_time_[kMainLoopEventCount];
+    Offender offenders_[8] = {};
+
+    MainLoopEvent current_event_ = kMainLoopEventSchedule;
+    // Read by CheckStall from another task, 0 while the loop is waiting
+    std::atomic<uint32_t> current_start_us_{0};
+    std::atomic<const char*> current_file_{nullptr};
+    std::atomic<const char*> current_caller_{nullptr};
+    std::atomic<int> current_line_{0};
+    std::atomic<bool> stall_reported_{false};
+
+    void AddOffender(const char* file, const char* caller, int line, uint32_t us);
+    // "caller (file:line)", or only the caller when there is no file
+    static void FormatSource(char* buffer, size_t size, const char* file, const char* caller, int line);
+};
+
+#endif // MAIN_LOOP_MONITOR_H
@@ -100,6 +100,32 @@ bool Ota::CheckVersion() {
         has_mqtt_config_ = true;
     }
 
+    has_websocket_config_ = false;
+    cJSON *websocket = cJSON_GetObjectItem(root, "websocket");
+    if (websocket != NULL) {
+        Settings settings("websocket", true);
+        cJSON *item = NULL;
+        cJSON_ArrayForEach(item, websocket) {
+            if (item->type == cJSON_String) {
+                if (settings.GetString(item->string) != item->valuestring) {
+                    settings.SetString(item->string, item->valuestring);
+                }
+            }
+        }
+        has_websocket_config_ = true;
+    }
+
+    // The transport the server wants, a new choice also clears an earlier fallback
+    cJSON *transport = cJSON_GetObjectItem(root, "transport");
+    if (cJSON_IsString(transport)) {
+        Settings settings("transport", true);
+        if (settings.GetString("preferred") != transport->valuestring) {
+            settings.SetString("preferred", transport->valuestring);
+            settings.EraseKey("active");
+            settings.EraseKey("active_boots");
+        }
+    }
+
     has_server_time_ = false;
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
     if (server_time != NULL) {
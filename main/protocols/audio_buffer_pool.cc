@@ -0,0 +1,110 @@
+#include "audio_buffer_pool.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define TAG "AudioBufferPool"
+
+AudioBufferPool::AudioBufferPool() {
+    free_slots_.reserve(CONFIG_AUDIO_BUFFER_POOL_SLOTS);
+    slot_data_.reserve(CONFIG_AUDIO_BUFFER_POOL_SLOTS);
+    overflow_data_.reserve(CONFIG_AUDIO_BUFFER_POOL_SLOTS);
+    for (int i = 0; i < CONFIG_AUDIO_BUFFER_POOL_SLOTS; i++) {
+        std::vector<uint8_t> slot;
+        slot.reserve(CONFIG_AUDIO_BUFFER_POOL_SLOT_SIZE);
+        slot_data_.push_back(slot.data());
+        free_slots_.push_back(std::move(slot));
+    }
+    min_free_slots_ = free_slots_.size();
+}
+
+bool AudioBufferPool::IsSlot(const std::vector<uint8_t>& buffer) const {
+    // A slot keeps its storage as long as nothing larger than the slot size was written to it
+    if (buffer.capacity() < CONFIG_AUDIO_BUFFER_POOL_SLOT_SIZE) {
+        return false;
+    }
+    return std::find(slot_data_.begin(), slot_data_.end(), buffer.data()) != slot_data_.end();
+}
+
+bool AudioBufferPool::Acquire(const uint8_t* data, size_t size, std::vector<uint8_t>& buffer, int timeout_ms) {
+    if (!Acquire(size, buffer, timeout_ms)) {
+        return false;
+    }
+    memcpy(buffer.data(), data, size);
+    return true;
+}
+
+bool AudioBufferPool::Acquire(size_t size, std::vector<uint8_t>& buffer, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    packet_count_++;
+    if (size > CONFIG_AUDIO_BUFFER_POOL_SLOT_SIZE) {
+        allocation_count_++;
+        lock.unlock();
+        buffer = std::vector<uint8_t>(size);
+        return true;
+    }
+
+    if (free_slots_.empty() && overflow_data_.size() < slot_data_.size()) {
+        AllocateOverflow(size, buffer);
+        return true;
+    }
+
+    if (free_slots_.empty()) {
+        wait_count_++;
+        if (!slot_released_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() {
+            return !free_slots_.empty() || overflow_data_.size() < slot_data_.size();
+        })) {
+            drop_count_++;
+            ESP_LOGW(TAG, "No free buffer in %d ms, dropped %lu packets", timeout_ms, drop_count_);
+            return false;
+        }
+        if (free_slots_.empty()) {
+            AllocateOverflow(size, buffer);
+            return true;
+        }
+    }
+
+    buffer = std::move(free_slots_.back());
+    free_slots_.pop_back();
+    min_free_slots_ = std::min(min_free_slots_, free_slots_.size());
+    lock.unlock();
+
+    buffer.resize(size);
+    return true;
+}
+
+// Called with mutex_ held
+void AudioBufferPool::AllocateOverflow(size_t size, std::vector<uint8_t>& buffer) {
+    overflow_count_++;
+    allocation_count_++;
+    // Never empty storage, the data pointer identifies the buffer on release
+    buffer = std::vector<uint8_t>();
+    buffer.reserve(std::max<size_t>(size, 1));
+    buffer.resize(size);
+    overflow_data_.push_back(buffer.data());
+}
+
+void AudioBufferPool::Release(std::vector<uint8_t>&& buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto overflow = std::find(overflow_data_.begin(), overflow_data_.end(), buffer.data());
+    if (overflow != overflow_data_.end()) {
+        overflow_data_.erase(overflow);
+        slot_released_.notify_one();
+        return;
+    }
+    if (!IsSlot(buffer) || free_slots_.size() >= slot_data_.size()) {
+        return;
+    }
+    buffer.clear();
+    free_slots_.push_back(std::move(buffer));
+    slot_released_.notify_one();
+}
+
+void AudioBufferPool::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "Packets: %lu, heap allocations: %lu (%lu with no free slot), waits: %lu, dropped: %lu, free slots: %u (min %u of %u)",
+        packet_count_, allocation_count_, overflow_count_, wait_count_, drop_count_,
+        (unsigned)free_slots_.size(), (unsigned)min_free_slots_, (unsigned)slot_data_.size());
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIO_BUFFER_POOL_H
+#define AUDIO_BUFFER_POOL_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+// Fixed set of preallocated receive buffers for downlink audio. The
+// transport copies each packet into a free slot and the playback pipeline
+// hands the slot back after decoding, so steady state playback does no heap
+// allocation. When all slots are in use, as many buffers again come from the
+// heap, so the receive task does not stall the control messages behind a
+// short burst and a buffer that never came back only costs allocations.
+// Only past that the receiver waits for a buffer to come back, which pushes
+// back on the server through TCP flow control.
+class AudioBufferPool {
+public:
+    static AudioBufferPool& GetInstance() {
+        static AudioBufferPool instance;
+        return instance;
+    }
+    AudioBufferPool(const AudioBufferPool&) = delete;
+    AudioBufferPool& operator=(const AudioBufferPool&) = delete;
+
+    // Copies the packet into a pooled buffer. Returns false if no buffer came
+    // back within timeout_ms, the caller should drop the packet.
+    bool Acquire(const uint8_t* data, size_t size, std::vector<uint8_t>& buffer, int timeout_ms);
+    // Same, for a caller that writes the packet itself, buffer holds size bytes
+    bool Acquire(size_t size, std::vector<uint8_t>& buffer, int timeout_ms);
+    // Takes back a buffer from Acquire, other buffers are simply freed
+    void Release(std::vector<uint8_t>&& buffer);
+    void PrintStats();
+
+private:
+    AudioBufferPool();
+
+    std::mutex mutex_;
+    std::condition_variable slot_released_;
+    std::vector<std::vector<uint8_t>> free_slots_;
+    // Data pointers of the pooled buffers, to tell them apart on release
+    std::vector<const uint8_t*> slot_data_;
+    // Data pointers of the heap buffers handed out while no slot was free
+    std::vector<const uint8_t*> overflow_data_;
+
+    uint32_t packet_count_ = 0;
+    uint32_t allocation_count_ = 0;
+    uint32_t overflow_count_ = 0;
+    uint32_t wait_count_ = 0;
+    uint32_t drop_count_ = 0;
+    size_t min_free_slots_ = 0;
+
+    bool IsSlot(const std::vector<uint8_t>& buffer) const;
+    void AllocateOverflow(size_t size, std::vector<uint8_t>& buffer);
+};
+
+#endif // AUDIO_BUFFER_POOL_H
@@ -0,0 +1,313 @@
+#include "cbor_encoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_ARRAY_START 0x9F
+#define CBOR_MAP_START 0xBF
+#define CBOR_BREAK 0xFF
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT64 0xFB
+
+#define MAX_DEPTH 32
+
+CborEncoder& CborEncoder::Clear() {
+    data_.clear();
+    return *this;
+}
+
+void CborEncoder::WriteHead(uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+        data_.push_back(major | value);
+        return;
+    }
+    int bytes;
+    if (value <= 0xFF) {
+        data_.push_back(major | 24);
+        bytes = 1;
+    } else if (value <= 0xFFFF) {
+        data_.push_back(major | 25);
+        bytes = 2;
+    } else if (value <= 0xFFFFFFFF) {
+        data_.push_back(major | 26);
+        bytes = 4;
+    } else {
+        data_.push_back(major | 27);
+        bytes = 8;
+    }
+    for (int i = bytes - 1; i >= 0; i--) {
+        data_.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
+
+void CborEncoder::SkipSpace() {
+    while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+        pos_++;
+    }
+}
+
+bool CborEncoder::EncodeJson(std::string_view json) {
+    pos_ = json.data();
+    end_ = json.data() + json.size();
+    if (!EncodeValue(0)) {
+        return false;
+    }
+    SkipSpace();
+    return pos_ == end_;
+}
+
+bool CborEncoder::EncodeValue(int depth) {
+    if (depth > MAX_DEPTH) {
+        return false;
+    }
+    SkipSpace();
+    if (pos_ >= end_) {
+        return false;
+    }
+
+    switch (*pos_) {
+    case '{': {
+        pos_++;
+        data_.push_back(CBOR_MAP_START);
+        SkipSpace();
+        if (pos_ < end_ && *pos_ == '}') {
+            pos_++;
+            data_.push_back(CBOR_BREAK);
+            return true;
+        }
+        while (true) {
+            SkipSpace();
+            if (pos_ >= end_ || *pos_ != '"' || !EncodeString()) {
+                return false;
+            }
+            SkipSpace();
+            if (pos_ >= end_ || *pos_++ != ':') {
+                return false;
+            }
+            if (!EncodeValue(depth + 1)) {
+                return false;
+            }
+            SkipSpace();
+            if (pos_ >= end_) {
+                return false;
+            }
+            char c = *pos_++;
+            if (c == '}') {
+                break;
+            } else if (c != ',') {
+                return false;
+            }
+        }
+        data_.push_back(CBOR_BREAK);
+        return true;
+    }
+    case '[': {
+        pos_++;
+        data_.push_back(CBOR_ARRAY_START);
+        SkipSpace();
+        if (pos_ < end_ && *pos_ == ']') {
+            pos_++;
+            data_.push_back(CBOR_BREAK);
+            return true;
+        }
+        while (true) {
+            if (!EncodeValue(depth + 1)) {
+                return false;
+            }
+            SkipSpace();
+            if (pos_ >= end_) {
+                return false;
+            }
+            char c = *pos_++;
+            if (c == ']') {
+                break;
+            } else if (c != ',') {
+                return false;
+            }
+        }
+        data_.push_back(CBOR_BREAK);
+        return true;
+    }
+    case '"':
+        return EncodeString();
+    case 't':
+        return EncodeLiteral("true", CBOR_TRUE);
+    case 'f':
+        return EncodeLiteral("false", CBOR_FALSE);
+    case 'n':
+        return EncodeLiteral("null", CBOR_NULL);
+    default:
+        return EncodeNumber();
+    }
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out.push_back(code);
+    } else if (code < 0x800) {
+        out.push_back(0xC0 | (code >> 6));
+        out.push_back(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out.push_back(0xE0 | (code >> 12));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    } else {
+        out.push_back(0xF0 | (code >> 18));
+        out.push_back(0x80 | ((code >> 12) & 0x3F));
+        out.push_back(0x80 | ((code >> 6) & 0x3F));
+        out.push_back(0x80 | (code & 0x3F));
+    }
+}
+
+bool CborEncoder::EncodeString() {
+    pos_++;
+    // Fast path: no escapes, the text is copied as is
+    auto start = pos_;
+    while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') {
+        pos_++;
+    }
+    if (pos_ < end_ && *pos_ == '"') {
+        WriteHead(CBOR_MAJOR_TEXT, pos_ - start);
+        data_.append(start, pos_ - start);
+        pos_++;
+        return true;
+    }
+
+    scratch_.assign(start, pos_ - start);
+    while (pos_ < end_ && *pos_ != '"') {
+        if (*pos_ != '\\') {
+            scratch_.push_back(*pos_++);
+            continue;
+        }
+        if (++pos_ >= end_) {
+            return false;
+        }
+        char c = *pos_++;
+        switch (c) {
+        case 'b': scratch_.push_back('\b'); break;
+        case 'f': scratch_.push_back('\f'); break;
+        case 'n': scratch_.push_back('\n'); break;
+        case 'r': scratch_.push_back('\r'); break;
+        case 't': scratch_.push_back('\t'); break;
+        case 'u': {
+            uint32_t code = 0;
+            for (int i = 0; i < 4; i++) {
+                int v = pos_ < end_ ? HexValue(*pos_++) : -1;
+                if (v < 0) {
+                    return false;
+                }
+                code = (code << 4) | v;
+            }
+            // Combine a surrogate pair into one code point
+            if (code >= 0xD800 && code < 0xDC00 && end_ - pos_ >= 6 && pos_[0] == '\\' && pos_[1] == 'u') {
+                uint32_t low = 0;
+                for (int i = 2; i < 6; i++) {
+                    int v = HexValue(pos_[i]);
+                    if (v < 0) {
+                        return false;
+                    }
+                    low = (low << 4) | v;
+                }
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    pos_ += 6;
+                }
+            }
+            // A surrogate left unpaired is not valid UTF-8, use the replacement character
+            if (code >= 0xD800 && code < 0xE000) {
+                code = 0xFFFD;
+            }
+            AppendUtf8(scratch_, code);
+            break;
+        }
+        default:
+            scratch_.push_back(c);
+            break;
+        }
+    }
+    if (pos_ >= end_) {
+        return false;
+    }
+    pos_++;
+    WriteHead(CBOR_MAJOR_TEXT, scratch_.size());
+    data_.append(scratch_);
+    return true;
+}
+
+bool CborEncoder::EncodeNumber() {
+    auto start = pos_;
+    bool integer = true;
+    while (pos_ < end_ && (isdigit((unsigned char)*pos_) || *pos_ == '-' || *pos_ == '+' ||
+        *pos_ == '.' || *pos_ == 'e' || *pos_ == 'E')) {
+        if (*pos_ == '.' || *pos_ == 'e' || *pos_ == 'E') {
+            integer = false;
+        }
+        pos_++;
+    }
+    size_t length = pos_ - start;
+    char buffer[32];
+    if (length == 0 || length >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+
+    char* number_end;
+    if (integer) {
+        errno = 0;
+        long long value = strtoll(buffer, &number_end, 10);
+        if (*number_end != '\0') {
+            return false;
+        }
+        // Out of the int64 range the number goes out as a float, like cJSON keeps it
+        if (errno != ERANGE) {
+            if (value >= 0) {
+                WriteHead(CBOR_MAJOR_UNSIGNED, value);
+            } else {
+                WriteHead(CBOR_MAJOR_NEGATIVE, -1 - value);
+            }
+            return true;
+        }
+    }
+
+    double value = strtod(buffer, &number_end);
+    if (*number_end != '\0' || !std::isfinite(value)) {
+        return false;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    data_.push_back(CBOR_FLOAT64);
+    for (int i = 7; i >= 0; i--) {
+        data_.push_back((bits >> (i * 8)) & 0xFF);
+    }
+    return true;
+}
+
+bool CborEncoder::EncodeLiteral(std::string_view literal, uint8_t value) {
+    if ((size_t)(end_ - pos_) < literal.size() || std::string_view(pos_, literal.size()) != literal) {
+        return false;
+    }
+    pos_ += literal.size();
+    data_.push_back(value);
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef CBOR_ENCODER_H
+#define CBOR_ENCODER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Transcodes JSON text to CBOR (RFC 8949) in a single pass without building
+// a tree. Objects and arrays become indefinite-length maps and arrays, so
+// nothing has to be counted ahead.
+class CborEncoder {
+public:
+    CborEncoder& Clear();
+    // Appends the CBOR encoding of one JSON value, returns false on malformed input
+    bool EncodeJson(std::string_view json);
+    const std::string& data() const { return data_; }
+
+private:
+    std::string data_;
+    // Unescaped string being encoded, keeps its capacity between calls
+    std::string scratch_;
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+
+    void WriteHead(uint8_t major, uint64_t value);
+    void SkipSpace();
+    bool EncodeValue(int depth);
+    bool EncodeString();
+    bool EncodeNumber();
+    bool EncodeLiteral(std::string_view literal, uint8_t value);
+};
+
+#endif // CBOR_ENCODER_H
@@ -0,0 +1,50 @@
+#include "frame_aggregator.h"
+
+#include <esp_log.h>
+
+#define TAG "FrameAggregator"
+
+void FrameAggregator::Configure(int max_frames, int frame_duration_ms, size_t packet_overhead) {
+    max_frames_ = max_frames > 1 ? max_frames : 1;
+    frame_duration_ms_ = frame_duration_ms;
+    packet_overhead_ = packet_overhead;
+    packet_.clear();
+    frames_ = 0;
+    total_frames_ = 0;
+    total_packets_ = 0;
+    saved_bytes_ = 0;
+}
+
+bool FrameAggregator::Append(const std::vector<uint8_t>& frame, uint32_t timestamp) {
+    if (frames_ == 0) {
+        timestamp_ = timestamp;
+    }
+    packet_.push_back(frame.size() >> 8);
+    packet_.push_back(frame.size() & 0xFF);
+    packet_.insert(packet_.end(), frame.begin(), frame.end());
+    last_timestamp_ = timestamp;
+    frames_++;
+    return frames_ >= max_frames_;
+}
+
+void FrameAggregator::Clear() {
+    if (frames_ > 0) {
+        total_frames_ += frames_;
+        total_packets_++;
+        // Every frame but the first saves a transport header and costs a length prefix
+        saved_bytes_ += (int64_t)(frames_ - 1) * packet_overhead_ - frames_ * 2;
+    }
+    // Keep the capacity for the next packet
+    packet_.clear();
+    frames_ = 0;
+}
+
+void FrameAggregator::PrintStats() {
+    if (!enabled() || total_frames_ == 0) {
+        return;
+    }
+    int64_t speech_ms = (int64_t)total_frames_ * frame_duration_ms_;
+    int64_t saved_packets = total_frames_ - total_packets_;
+    ESP_LOGI(TAG, "Aggregated %lu frames into %lu packets, saved %lld packets and %lld bytes per minute of speech",
+        total_frames_, total_packets_, saved_packets * 60000 / speech_ms, saved_bytes_ * 60000 / speech_ms);
+}
@@ -0,0 +1,66 @@
+#ifndef FRAME_AGGREGATOR_H
+#define FRAME_AGGREGATOR_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Packs several opus frames into one transport packet, each frame prefixed
+// with its length as a big-endian uint16.
+class FrameAggregator {
+public:
+    // max_frames of 1 disables aggregation, packet_overhead is the per-packet
+    // transport header size that every aggregated frame saves
+    void Configure(int max_frames, int frame_duration_ms, size_t packet_overhead);
+    // Returns true when the packet is full and should be sent
+    bool Append(const std::vector<uint8_t>& frame, uint32_t timestamp);
+    // Appends the frame and sends full packets with send(packet, timestamp).
+    // A packet whose send failed is kept and sent first on the next call, so
+    // its frames are not lost; if that call retries the frame that completed
+    // the packet, the frame is not added twice. Returns false if the frame
+    // could not be sent and should be retried.
+    template <typename F>
+    bool Submit(const std::vector<uint8_t>& frame, uint32_t timestamp, F&& send) {
+        if (frames_ >= max_frames_) {
+            if (!send(packet_, timestamp_)) {
+                return false;
+            }
+            bool retried = timestamp == last_timestamp_;
+            Clear();
+            if (retried) {
+                return true;
+            }
+        }
+        if (Append(frame, timestamp)) {
+            if (!send(packet_, timestamp_)) {
+                return false;
+            }
+            Clear();
+        }
+        return true;
+    }
+    // Start a new packet after the current one has been sent
+    void Clear();
+    void PrintStats();
+
+    inline bool enabled() const { return max_frames_ > 1; }
+    inline bool empty() const { return frames_ == 0; }
+    inline const std::vector<uint8_t>& packet() const { return packet_; }
+    // Capture timestamp of the first frame in the packet
+    inline uint32_t timestamp() const { return timestamp_; }
+
+private:
+    std::vector<uint8_t> packet_;
+    int max_frames_ = 1;
+    int frame_duration_ms_ = 60;
+    size_t packet_overhead_ = 0;
+    int frames_ = 0;
+    uint32_t timestamp_ = 0;
+    uint32_t last_timestamp_ = 0;
+
+    uint32_t total_frames_ = 0;
+    uint32_t total_packets_ = 0;
+    int64_t saved_bytes_ = 0;
+};
+
+#endif // FRAME_AGGREGATOR_H
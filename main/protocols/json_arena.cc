@@ -0,0 +1,87 @@
+#include "json_arena.h"
+
+#include <cJSON.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstdlib>
+
+#define TAG "JsonArena"
+
+#define JSON_ARENA_ALIGNMENT 8
+
+static thread_local JsonArena* active_arena = nullptr;
+
+JsonArena::JsonArena(size_t size) : size_(size) {
+    // Installed once, before the first arena can be used by any task
+    static bool hooks_installed = []() {
+        cJSON_Hooks hooks = {
+            .malloc_fn = Malloc,
+            .free_fn = Free,
+        };
+        cJSON_InitHooks(&hooks);
+        return true;
+    }();
+    (void)hooks_installed;
+
+    buffer_ = (uint8_t*)heap_caps_malloc_prefer(size_, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_DEFAULT);
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes, using malloc", size_);
+        size_ = 0;
+    }
+}
+
+JsonArena::~JsonArena() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+JsonArena::Scope::Scope(JsonArena& arena) : arena_(arena), lock_(arena.mutex_), previous_(active_arena) {
+    active_arena = &arena_;
+}
+
+JsonArena::Scope::~Scope() {
+    active_arena = previous_;
+    arena_.Reset();
+}
+
+void JsonArena::Reset() {
+    if (used_ > peak_used_) {
+        peak_used_ = used_;
+    }
+    used_ = 0;
+}
+
+void JsonArena::PrintStats() {
+    ESP_LOGI(TAG, "Peak usage: %u/%u bytes, malloc fallbacks: %lu", peak_used_, size_, fallback_count_);
+}
+
+void* JsonArena::Allocate(size_t size) {
+    size_t aligned = (size + JSON_ARENA_ALIGNMENT - 1) & ~(size_t)(JSON_ARENA_ALIGNMENT - 1);
+    if (aligned > size_ - used_) {
+        fallback_count_++;
+        return malloc(size);
+    }
+    void* ptr = buffer_ + used_;
+    used_ += aligned;
+    return ptr;
+}
+
+bool JsonArena::Contains(const void* ptr) const {
+    return ptr >= buffer_ && ptr < buffer_ + size_;
+}
+
+void* JsonArena::Malloc(size_t size) {
+    if (active_arena != nullptr) {
+        return active_arena->Allocate(size);
+    }
+    return malloc(size);
+}
+
+// Arena memory is released by Reset(), only fallback allocations are freed here
+void JsonArena::Free(void* ptr) {
+    if (active_arena != nullptr && active_arena->Contains(ptr)) {
+        return;
+    }
+    free(ptr);
+}
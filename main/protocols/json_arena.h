@@ -0,0 +1,50 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Bump allocator for cJSON. The cJSON hooks are process-wide, but the arena
+// is only used by the task that holds a Scope on it: every cJSON allocation
+// made by that task comes from the arena and frees are no-ops; Reset()
+// releases everything at once. Other tasks, such as ThingManager or the OTA
+// check, keep using malloc. A Scope locks the arena, so tasks sharing one take
+// turns. Trees parsed in a scope must be deleted before it ends.
+class JsonArena {
+public:
+    explicit JsonArena(size_t size);
+    ~JsonArena();
+
+    // Locks the arena and activates it on the current task for its
+    // lifetime, then resets it
+    class Scope {
+    public:
+        explicit Scope(JsonArena& arena);
+        ~Scope();
+    private:
+        JsonArena& arena_;
+        std::lock_guard<std::mutex> lock_;
+        JsonArena* previous_;
+    };
+
+    void Reset();
+    void PrintStats();
+
+private:
+    std::mutex mutex_;
+    uint8_t* buffer_ = nullptr;
+    size_t size_ = 0;
+    size_t used_ = 0;
+
+    size_t peak_used_ = 0;
+    uint32_t fallback_count_ = 0;
+
+    void* Allocate(size_t size);
+    bool Contains(const void* ptr) const;
+
+    static void* Malloc(size_t size);
+    static void Free(void* ptr);
+};
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,124 @@
+#include "json_writer.h"
+
+#include <cstdio>
+#include <cinttypes>
+
+JsonWriter::JsonWriter(size_t capacity) {
+    buffer_.reserve(capacity);
+}
+
+JsonWriter& JsonWriter::Clear() {
+    buffer_.clear();
+    return *this;
+}
+
+// A value or key needs a comma unless it starts a container or follows a key
+void JsonWriter::Separate() {
+    if (buffer_.empty()) {
+        return;
+    }
+    char last = buffer_.back();
+    if (last != '{' && last != '[' && last != ':') {
+        buffer_ += ',';
+    }
+}
+
+void JsonWriter::AppendEscaped(std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+    buffer_ += '"';
+    // Copy runs of characters that need no escaping in one append
+    size_t run = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        uint8_t c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        buffer_.append(value.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"':
+            buffer_ += "\\\"";
+            break;
+        case '\\':
+            buffer_ += "\\\\";
+            break;
+        case '\b':
+            buffer_ += "\\b";
+            break;
+        case '\f':
+            buffer_ += "\\f";
+            break;
+        case '\n':
+            buffer_ += "\\n";
+            break;
+        case '\r':
+            buffer_ += "\\r";
+            break;
+        case '\t':
+            buffer_ += "\\t";
+            break;
+        default:
+            buffer_ += "\\u00";
+            buffer_ += hex[c >> 4];
+            buffer_ += hex[c & 0x0F];
+            break;
+        }
+    }
+    buffer_.append(value.data() + run, value.size() - run);
+    buffer_ += '"';
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Separate();
+    buffer_ += '{';
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    buffer_ += '}';
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Separate();
+    buffer_ += '[';
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    buffer_ += ']';
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key) {
+    Separate();
+    AppendEscaped(key);
+    buffer_ += ':';
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value) {
+    Separate();
+    AppendEscaped(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    Separate();
+    char number[24];
+    int length = snprintf(number, sizeof(number), "%" PRId64, value);
+    buffer_.append(number, length);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    Separate();
+    buffer_ += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(std::string_view json) {
+    Separate();
+    buffer_.append(json.data(), json.size());
+    return *this;
+}
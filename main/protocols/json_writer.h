@@ -0,0 +1,45 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// Streaming JSON writer over a reusable buffer. Commas are inserted
+// automatically and string values are escaped.
+class JsonWriter {
+public:
+    explicit JsonWriter(size_t capacity = 256);
+
+    // Start a new message, the buffer keeps its capacity
+    JsonWriter& Clear();
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(std::string_view key);
+
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    // Append an already serialized JSON value as is
+    JsonWriter& Raw(std::string_view json);
+
+    inline JsonWriter& Add(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    inline JsonWriter& Add(std::string_view key, const char* value) { return Key(key).String(value); }
+    inline JsonWriter& Add(std::string_view key, int value) { return Key(key).Int(value); }
+    inline JsonWriter& Add(std::string_view key, bool value) { return Key(key).Bool(value); }
+    inline JsonWriter& AddRaw(std::string_view key, std::string_view json) { return Key(key).Raw(json); }
+
+    inline const std::string& str() const { return buffer_; }
+
+private:
+    std::string buffer_;
+
+    void Separate();
+    void AppendEscaped(std::string_view value);
+};
+
+#endif // JSON_WRITER_H
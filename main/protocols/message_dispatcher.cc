@@ -0,0 +1,75 @@
+#include "message_dispatcher.h"
+
+#include <esp_log.h>
+
+#define TAG "MessageDispatcher"
+
+static std::string_view GetString(const cJSON* root, const char* key) {
+    auto item = cJSON_GetObjectItem(root, key);
+    if (!cJSON_IsString(item) || item->valuestring == nullptr) {
+        return std::string_view();
+    }
+    return std::string_view(item->valuestring);
+}
+
+MessageDispatcher::MessageDispatcher() : arena_(CONFIG_JSON_ARENA_SIZE) {
+}
+
+void MessageDispatcher::Register(std::string_view type, std::string_view state, Handler handler) {
+    routes_[type].push_back({state, std::move(handler)});
+}
+
+bool MessageDispatcher::Dispatch(const char* data, size_t len) {
+    JsonArena::Scope scope(arena_);
+    cJSON* root = cJSON_ParseWithLength(data, len);
+    if (root == nullptr) {
+        malformed_count_++;
+        ESP_LOGE(TAG, "Failed to parse json message: %.*s", (int)len, data);
+        return false;
+    }
+
+    IncomingMessage message = {
+        .type = GetString(root, "type"),
+        .state = GetString(root, "state"),
+        .session_id = GetString(root, "session_id"),
+        .text = GetString(root, "text"),
+        .emotion = GetString(root, "emotion"),
+        .root = root,
+    };
+    if (message.type.empty()) {
+        malformed_count_++;
+        ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+        cJSON_Delete(root);
+        return false;
+    }
+
+    const Handler* handler = nullptr;
+    auto it = routes_.find(message.type);
+    if (it != routes_.end()) {
+        for (auto& route : it->second) {
+            if (route.state == message.state) {
+                handler = &route.handler;
+                break;
+            }
+            if (route.state.empty() && handler == nullptr) {
+                handler = &route.handler;
+            }
+        }
+    }
+
+    if (handler != nullptr) {
+        dispatched_count_++;
+        (*handler)(message);
+    } else {
+        unhandled_count_++;
+        ESP_LOGD(TAG, "No handler for message type %.*s", (int)message.type.size(), message.type.data());
+    }
+    cJSON_Delete(root);
+    return true;
+}
+
+void MessageDispatcher::PrintStats() {
+    ESP_LOGI(TAG, "Messages dispatched: %lu, unhandled: %lu, malformed: %lu",
+        dispatched_count_, unhandled_count_, malformed_count_);
+    arena_.PrintStats();
+}
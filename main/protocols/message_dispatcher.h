@@ -0,0 +1,53 @@
+#ifndef MESSAGE_DISPATCHER_H
+#define MESSAGE_DISPATCHER_H
+
+#include "json_arena.h"
+
+#include <cJSON.h>
+#include <string_view>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+// Common fields of a server message, extracted once per message. The views
+// and root are only valid during the handler call.
+struct IncomingMessage {
+    std::string_view type;
+    std::string_view state;
+    std::string_view session_id;
+    std::string_view text;
+    std::string_view emotion;
+    const cJSON* root;
+};
+
+// Routes JSON messages to handlers by type and optional state
+class MessageDispatcher {
+public:
+    using Handler = std::function<void(const IncomingMessage& message)>;
+
+    MessageDispatcher();
+
+    // type and state must outlive the dispatcher (string literals). An empty
+    // state matches every message of the type without a more specific route.
+    void Register(std::string_view type, std::string_view state, Handler handler);
+    // Parse a message of len bytes, which need not be NUL-terminated, and call
+    // its handler. Returns false if the message is malformed.
+    bool Dispatch(const char* data, size_t len);
+    void PrintStats();
+
+private:
+    struct Route {
+        std::string_view state;
+        Handler handler;
+    };
+    std::unordered_map<std::string_view, std::vector<Route>> routes_;
+    // Holds the parsed tree of the message being dispatched
+    JsonArena arena_;
+
+    uint32_t dispatched_count_ = 0;
+    uint32_t unhandled_count_ = 0;
+    uint32_t malformed_count_ = 0;
+};
+
+#endif // MESSAGE_DISPATCHER_H
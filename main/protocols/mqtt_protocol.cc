@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_buffer_pool.h"
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -12,8 +13,28 @@
 
 #define TAG "MQTT"
 
-MqttProtocol::MqttProtocol() {
+MqttProtocol::MqttProtocol() : reorder_window_(CONFIG_UDP_REORDER_WINDOW_DEPTH, CONFIG_UDP_REORDER_MAX_HOLD_MS) {
     event_group_handle_ = xEventGroupCreate();
+
+    reorder_window_.OnRelease([this](std::vector<uint8_t>&& data) {
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(data));
+        }
+    });
+
+    OnIncomingMessage("hello", "", [this](const IncomingMessage& message) {
+        ParseServerHello(message.root);
+    });
+    OnIncomingMessage("goodbye", "", [this](const IncomingMessage& message) {
+        ESP_LOGI(TAG, "Received goodbye message, session_id: %.*s", (int)message.session_id.size(), message.session_id.data());
+        if (message.session_id.empty() || message.session_id == session_id_) {
+            Application::GetInstance().Schedule([this, alive = std::weak_ptr<bool>(alive_)]() {
+                if (!alive.expired()) {
+                    CloseAudioChannel();
+                }
+            });
+        }
+    });
 }
 
 MqttProtocol::~MqttProtocol() {
@@ -60,32 +81,9 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+        if (!message_dispatcher_.Dispatch(payload.data(), payload.size())) {
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (type == nullptr) {
-            ESP_LOGE(TAG, "Message type is not specified");
-            cJSON_Delete(root);
-            return;
-        }
-
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
-                Application::GetInstance().Schedule([this]() {
-                    CloseAudioChannel();
-                });
-            }
-        } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
-        }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -110,44 +108,60 @@ void MqttProtocol::SendText(const std::string& text) {
     }
 }
 
-void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
+// CBOR payloads start with a map header, JSON ones with '{', so both share the topic
+void MqttProtocol::SendBinaryMessage(const std::string& data) {
+    SendText(data);
+}
+
+bool MqttProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
-        return;
+        return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    if (frame_aggregator_.enabled()) {
+        return frame_aggregator_.Submit(data, timestamp, [this](const std::vector<uint8_t>& packet, uint32_t) {
+            return SendAudioPacket(packet.data(), packet.size());
+        });
+    }
+    return SendAudioPacket(data.data(), data.size());
+}
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+void MqttProtocol::FlushAudio() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr || frame_aggregator_.empty()) {
         return;
     }
-    udp_->Send(encrypted);
+    auto& packet = frame_aggregator_.packet();
+    SendAudioPacket(packet.data(), packet.size());
+    frame_aggregator_.Clear();
+}
+
+// Must be called with channel_mutex_ held
+bool MqttProtocol::SendAudioPacket(const uint8_t* data, size_t size) {
+    // Build the packet in the reused send buffer: nonce header followed by the encrypted payload
+    if (!udp_cipher_.Encrypt(data, size, ++local_sequence_, udp_send_buffer_)) {
+        return false;
+    }
+    return udp_->Send(udp_send_buffer_) >= 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
+    StopHeartbeat();
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         if (udp_ != nullptr) {
             delete udp_;
             udp_ = nullptr;
+            reorder_window_.PrintStats();
+            frame_aggregator_.PrintStats();
+            message_dispatcher_.PrintStats();
+            network_monitor_.PrintStats();
+            frame_aggregator_.Clear();
         }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
-    SendText(message);
+    SendText(BeginMessage("goodbye").EndObject().str());
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
@@ -164,17 +178,28 @@ bool MqttProtocol::OpenAudioChannel() {
 
     error_occurred_ = false;
     session_id_ = "";
+    network_monitor_.Reset();
+    heartbeat_interval_ms_ = 0;
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
     // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    SendText(message);
+    auto& json = json_writer_.Clear().BeginObject()
+        .Add("type", "hello")
+        .Add("version", 3)
+        .Add("transport", "udp")
+        .Add("heartbeat_interval", CONFIG_PROTOCOL_HEARTBEAT_INTERVAL_MS)
+        .Add("iot_encoding", "cbor");
+    json.Key("audio_params").BeginObject()
+        .Add("format", "opus")
+        .Add("sample_rate", 16000)
+        .Add("channels", 1)
+        .Add("frame_duration", OPUS_FRAME_DURATION_MS);
+    if (GetMaxFramesPerPacket() > 1) {
+        json.Add("max_frames_per_packet", GetMaxFramesPerPacket());
+    }
+    json.EndObject().EndObject();
+    auto hello_time = esp_timer_get_time();
+    SendText(json.str());
 
     // 等待服务器响应
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -183,14 +208,16 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    network_monitor_.OnRttSample((esp_timer_get_time() - hello_time) / 1000);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ != nullptr) {
         delete udp_;
     }
     udp_ = Board::GetInstance().CreateUdp();
+    udp_send_buffer_.reserve(UDP_AUDIO_HEADER_SIZE + 1024);
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < UDP_AUDIO_HEADER_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -198,35 +225,28 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
+        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
+        network_monitor_.OnAudioPacket(sequence, timestamp);
 
-        std::vector<uint8_t> decrypted;
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        // Decrypt straight into a pool slot that is handed over to the decode queue.
+        // UDP has no flow control, so a full pool drops the packet instead of waiting.
+        auto& pool = AudioBufferPool::GetInstance();
+        std::vector<uint8_t> opus;
+        if (!pool.Acquire(data.size() - UDP_AUDIO_HEADER_SIZE, opus, 0)) {
             return;
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(decrypted));
+        if (!udp_cipher_.Decrypt((const uint8_t*)data.data(), data.size(), opus.data())) {
+            pool.Release(std::move(opus));
+            return;
         }
-        remote_sequence_ = sequence;
+        // Packets are released to on_incoming_audio_ in sequence order
+        reorder_window_.Push(sequence, std::move(opus));
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
+    StartHeartbeat();
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -255,6 +275,10 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
             server_sample_rate_ = sample_rate->valueint;
         }
     }
+    NegotiateHeartbeat(root);
+    NegotiateIot(root);
+    // Nonce header plus IP/UDP headers
+    ConfigureFrameAggregation(audio_params, UDP_AUDIO_HEADER_SIZE + 28);
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (udp == nullptr) {
@@ -268,11 +292,11 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    if (!udp_cipher_.SetKey(DecodeHexString(key), DecodeHexString(nonce))) {
+        return;
+    }
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    reorder_window_.Reset();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
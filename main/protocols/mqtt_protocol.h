@@ -3,10 +3,11 @@
 
 
 #include "protocol.h"
+#include "reorder_window.h"
+#include "udp_audio_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
@@ -26,7 +27,7 @@ public:
     ~MqttProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    bool SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -43,18 +44,22 @@ private:
     std::mutex channel_mutex_;
     Mqtt* mqtt_ = nullptr;
     Udp* udp_ = nullptr;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    UdpAudioCipher udp_cipher_;
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    ReorderWindow reorder_window_;
 
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
     void SendText(const std::string& text) override;
+    bool SupportsBinaryMessages() const override { return true; }
+    void SendBinaryMessage(const std::string& data) override;
+    void FlushAudio() override;
+    bool SendAudioPacket(const uint8_t* data, size_t size);
 };
 
 
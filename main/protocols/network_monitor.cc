@@ -0,0 +1,69 @@
+#include "network_monitor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdlib>
+
+#define TAG "NetworkMonitor"
+
+void NetworkMonitor::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    srtt_ms_ = -1;
+    jitter_ = 0;
+    last_transit_ = 0;
+    has_transit_ = false;
+    base_sequence_ = 0;
+    highest_sequence_ = 0;
+    received_packets_ = 0;
+}
+
+void NetworkMonitor::OnRttSample(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Same smoothing as the TCP retransmission timer (RFC 6298)
+    if (srtt_ms_ < 0) {
+        srtt_ms_ = rtt_ms;
+    } else {
+        srtt_ms_ += (rtt_ms - srtt_ms_) / 8;
+    }
+}
+
+void NetworkMonitor::OnAudioPacket(uint32_t sequence, uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (received_packets_ == 0) {
+        base_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    } else if ((int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    received_packets_++;
+
+    // Only the change of the transit time matters, so the clocks need not be synchronized
+    int32_t arrival = esp_timer_get_time() / 1000;
+    int32_t transit = arrival - (int32_t)timestamp;
+    if (has_transit_) {
+        int32_t d = abs(transit - last_transit_);
+        jitter_ += d - ((jitter_ + 8) >> 4);
+    }
+    last_transit_ = transit;
+    has_transit_ = true;
+}
+
+NetworkQuality NetworkMonitor::GetQuality() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    NetworkQuality quality;
+    quality.rtt_ms = srtt_ms_;
+    quality.jitter_ms = jitter_ >> 4;
+    quality.received_packets = received_packets_;
+    if (received_packets_ > 0) {
+        uint32_t expected = highest_sequence_ - base_sequence_ + 1;
+        quality.lost_packets = expected > received_packets_ ? expected - received_packets_ : 0;
+        quality.loss_percent = quality.lost_packets * 100 / expected;
+    }
+    return quality;
+}
+
+void NetworkMonitor::PrintStats() {
+    auto quality = GetQuality();
+    ESP_LOGI(TAG, "RTT: %d ms, jitter: %d ms, received: %lu, lost: %lu (%d%%)",
+        quality.rtt_ms, quality.jitter_ms, quality.received_packets, quality.lost_packets, quality.loss_percent);
+}
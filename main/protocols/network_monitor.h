@@ -0,0 +1,39 @@
+#ifndef NETWORK_MONITOR_H
+#define NETWORK_MONITOR_H
+
+#include <mutex>
+#include <cstdint>
+
+struct NetworkQuality {
+    int rtt_ms = -1;            // Smoothed round trip time, -1 if not measured yet
+    int jitter_ms = 0;          // Interarrival jitter of the downlink audio
+    uint32_t received_packets = 0;
+    uint32_t lost_packets = 0;
+    int loss_percent = 0;
+};
+
+// Tracks the quality of the audio channel for one session. RTT comes from
+// control message round trips, jitter and loss from the downlink audio
+// sequence numbers and timestamps.
+class NetworkMonitor {
+public:
+    void Reset();
+    void OnRttSample(int rtt_ms);
+    // timestamp is the sender's capture time of the packet in milliseconds
+    void OnAudioPacket(uint32_t sequence, uint32_t timestamp);
+    NetworkQuality GetQuality();
+    void PrintStats();
+
+private:
+    std::mutex mutex_;
+    int srtt_ms_ = -1;
+    // RFC 3550 interarrival jitter, scaled by 16
+    int32_t jitter_ = 0;
+    int32_t last_transit_ = 0;
+    bool has_transit_ = false;
+    uint32_t base_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    uint32_t received_packets_ = 0;
+};
+
+#endif // NETWORK_MONITOR_H
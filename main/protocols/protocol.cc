@@ -1,11 +1,46 @@
 #include "protocol.h"
+#include "board.h"
+#include "application.h"
 
 #include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+#include "assets/lang_config.h"
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
-    on_incoming_json_ = callback;
+Protocol::Protocol() {
+    heartbeat_timer_ = TimerService::GetInstance().Create("heartbeat", CONFIG_HOUSEKEEPING_TIMER_SLACK_MS,
+        [this, alive = std::weak_ptr<bool>(alive_)]() {
+        Application::GetInstance().Schedule([this, alive]() {
+            if (!alive.expired()) {
+                OnHeartbeatTimer();
+            }
+        });
+    });
+
+    OnIncomingMessage("pong", "", [this](const IncomingMessage& message) {
+        auto id = cJSON_GetObjectItem(message.root, "id");
+        if (!cJSON_IsNumber(id)) {
+            return;
+        }
+        // Take the receive time here, the main loop may be busy
+        int64_t receive_time = esp_timer_get_time();
+        Application::GetInstance().Schedule([this, alive = std::weak_ptr<bool>(alive_), id = (uint32_t)id->valuedouble,
+            receive_time]() {
+            if (!alive.expired()) {
+                OnPong(id, receive_time);
+            }
+        });
+    });
+}
+
+Protocol::~Protocol() {
+    TimerService::GetInstance().Delete(heartbeat_timer_);
+}
+
+void Protocol::OnIncomingMessage(std::string_view type, std::string_view state, MessageDispatcher::Handler handler) {
+    message_dispatcher_.Register(type, state, std::move(handler));
 }
 
 void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
@@ -31,88 +66,170 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+JsonWriter& Protocol::BeginMessage(const char* type) {
+    return json_writer_.Clear().BeginObject()
+        .Add("session_id", session_id_)
+        .Add("type", type);
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    auto& json = BeginMessage("abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        json.Add("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    SendText(json.EndObject().str());
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    auto& json = BeginMessage("listen")
+        .Add("state", "detect")
+        .Add("text", wake_word);
+    SendText(json.EndObject().str());
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    auto& json = BeginMessage("listen").Add("state", "start");
     if (mode == kListeningModeAlwaysOn) {
-        message += ",\"mode\":\"realtime\"";
+        json.Add("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        json.Add("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        json.Add("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    SendText(json.EndObject().str());
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    // The last frames of the utterance must reach the server before it stops listening
+    FlushAudio();
+    auto& json = BeginMessage("listen").Add("state", "stop");
+    SendText(json.EndObject().str());
 }
 
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
-        return;
+// FNV-1a over all descriptors, the server echoes the version it has in the hello
+static std::string GetDescriptorsVersion(const std::vector<std::string>& descriptors) {
+    uint32_t hash = 2166136261u;
+    for (auto& descriptor : descriptors) {
+        for (char c : descriptor) {
+            hash = (hash ^ (uint8_t)c) * 16777619u;
+        }
+        hash = (hash ^ ',') * 16777619u;
     }
+    char version[9];
+    snprintf(version, sizeof(version), "%08lx", (unsigned long)hash);
+    return version;
+}
 
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
+void Protocol::SendIotDescriptors(const std::vector<std::string>& descriptors) {
+    auto version = GetDescriptorsVersion(descriptors);
+    if (version == server_iot_version_) {
+        ESP_LOGI(TAG, "Server already has IoT descriptors version %s", version.c_str());
         return;
     }
 
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
+    for (size_t i = 0; i < descriptors.size(); i++) {
+        auto& json = BeginMessage("iot").Add("update", true);
+        // The version goes with the last descriptor, the server stores it once it has all of them
+        if (i == descriptors.size() - 1) {
+            json.Add("version", version);
         }
+        json.Key("descriptors").BeginArray().Raw(descriptors[i]).EndArray().EndObject();
+        SendIotMessage(json);
+    }
+    // Not remembered here, only the version the server echoes in its hello proves it stored them
+}
 
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
+void Protocol::SendIotStates(const std::string& states) {
+    SendIotMessage(BeginMessage("iot").Add("update", true).AddRaw("states", states).EndObject());
+}
 
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
+void Protocol::SendIotMessage(JsonWriter& json) {
+    if (iot_cbor_ && cbor_encoder_.Clear().EncodeJson(json.str())) {
+        iot_bytes_sent_ += cbor_encoder_.data().size();
+        SendBinaryMessage(cbor_encoder_.data());
+        return;
+    }
+    iot_bytes_sent_ += json.str().size();
+    SendText(json.str());
+}
 
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
-        }
+// Only cellular links pay enough per-packet overhead to trade latency for fewer packets
+int Protocol::GetMaxFramesPerPacket() const {
+    if (Board::GetInstance().GetBoardType() != "ml307") {
+        return 1;
+    }
+    int max_frames = CONFIG_AUDIO_AGGREGATION_LATENCY_BUDGET_MS / OPUS_FRAME_DURATION_MS;
+    return max_frames > 1 ? max_frames : 1;
+}
 
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+void Protocol::ConfigureFrameAggregation(const cJSON* audio_params, size_t packet_overhead) {
+    int frames_per_packet = 1;
+    auto item = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+    if (cJSON_IsNumber(item)) {
+        frames_per_packet = std::min(item->valueint, GetMaxFramesPerPacket());
     }
+    frame_aggregator_.Configure(frames_per_packet, OPUS_FRAME_DURATION_MS, packet_overhead);
+    if (frame_aggregator_.enabled()) {
+        ESP_LOGI(TAG, "Uplink audio aggregation enabled, %d frames per packet", frames_per_packet);
+    }
+}
 
-    cJSON_Delete(root);
+void Protocol::NegotiateHeartbeat(const cJSON* root) {
+    auto interval = cJSON_GetObjectItem(root, "heartbeat_interval");
+    heartbeat_interval_ms_ = cJSON_IsNumber(interval) ? std::max(interval->valueint, 200) : 0;
 }
 
-void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
-    SendText(message);
+void Protocol::NegotiateIot(const cJSON* root) {
+    auto encoding = cJSON_GetObjectItem(root, "iot_encoding");
+    iot_cbor_ = SupportsBinaryMessages() && cJSON_IsString(encoding) && strcmp(encoding->valuestring, "cbor") == 0;
+    auto version = cJSON_GetObjectItem(root, "iot_version");
+    server_iot_version_ = cJSON_IsString(version) ? version->valuestring : "";
+}
+
+void Protocol::StartHeartbeat() {
+    StopHeartbeat();
+    if (heartbeat_interval_ms_ == 0) {
+        return;
+    }
+    heartbeat_pending_id_ = 0;
+    heartbeat_misses_ = 0;
+    TimerService::GetInstance().StartPeriodic(heartbeat_timer_, heartbeat_interval_ms_);
+}
+
+void Protocol::StopHeartbeat() {
+    TimerService::GetInstance().Stop(heartbeat_timer_);
+    heartbeat_pending_id_ = 0;
+}
+
+// A dead link is noticed after at most (misses + 1) heartbeat intervals
+void Protocol::OnHeartbeatTimer() {
+    if (heartbeat_interval_ms_ == 0 || !IsAudioChannelOpened()) {
+        return;
+    }
+    if (heartbeat_pending_id_ != 0) {
+        heartbeat_misses_++;
+        if (heartbeat_misses_ >= CONFIG_PROTOCOL_HEARTBEAT_MAX_MISSES) {
+            ESP_LOGE(TAG, "No heartbeat response for %d ms, closing audio channel",
+                heartbeat_misses_ * heartbeat_interval_ms_);
+            StopHeartbeat();
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+            CloseAudioChannel();
+            return;
+        }
+    }
+
+    heartbeat_pending_id_ = ++heartbeat_sequence_;
+    heartbeat_sent_time_ = esp_timer_get_time();
+    SendText(BeginMessage("ping").Add("id", (int)heartbeat_pending_id_).EndObject().str());
+}
+
+void Protocol::OnPong(uint32_t id, int64_t receive_time) {
+    if (id != heartbeat_pending_id_) {
+        return;
+    }
+    network_monitor_.OnRttSample((receive_time - heartbeat_sent_time_) / 1000);
+    heartbeat_pending_id_ = 0;
+    heartbeat_misses_ = 0;
 }
 
 bool Protocol::IsTimeout() const {
@@ -1,10 +1,35 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include "frame_aggregator.h"
+#include "json_writer.h"
+#include "message_dispatcher.h"
+#include "network_monitor.h"
+#include "cbor_encoder.h"
+#include "timer_service.h"
+
 #include <cJSON.h>
+#include <esp_timer.h>
 #include <string>
+#include <vector>
 #include <functional>
 #include <chrono>
+#include <memory>
+
+// Audio frame of the negotiated binary protocol version 2, all fields in network byte order
+struct BinaryProtocol2 {
+    uint16_t version;
+    uint16_t type;          // Frame type (0: OPUS, 1: CBOR message)
+    uint32_t sequence;      // Frame sequence number, starts from 1 for every audio channel
+    uint32_t timestamp;     // Capture timestamp in milliseconds
+    uint32_t payload_size;  // Payload size in bytes
+    uint8_t payload[];      // Payload data
+} __attribute__((packed));
+
+enum BinaryFrameType {
+    kBinaryFrameTypeOpus = 0,
+    kBinaryFrameTypeCbor = 1
+};
 
 struct BinaryProtocol3 {
     uint8_t type;
@@ -26,7 +51,8 @@ enum ListeningMode {
 
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    Protocol();
+    virtual ~Protocol();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
@@ -34,9 +60,17 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline NetworkQuality GetNetworkQuality() {
+        return network_monitor_.GetQuality();
+    }
+    // Total bytes of IoT descriptors and states handed to the transport
+    inline size_t iot_bytes_sent() const {
+        return iot_bytes_sent_;
+    }
 
     virtual void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Handle server messages of the given type, and state if not empty
+    void OnIncomingMessage(std::string_view type, std::string_view state, MessageDispatcher::Handler handler);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -45,27 +79,66 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    // Returns false if the transport could not take the audio, the caller may retry later
+    virtual bool SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    // One descriptor per thing, skipped when the server already has this version
+    virtual void SendIotDescriptors(const std::vector<std::string>& descriptors);
     virtual void SendIotStates(const std::string& states);
 
     protected:
     std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
-    std::function<void(const cJSON* root)> on_incoming_json_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
+    // Held weakly by the tasks the protocol schedules on the main loop, a task
+    // that runs after the protocol was replaced does nothing
+    std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
     int server_sample_rate_ = 16000;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    FrameAggregator frame_aggregator_;
+    MessageDispatcher message_dispatcher_;
+    NetworkMonitor network_monitor_;
+    // Reused for every outgoing message, only touched from the main loop
+    JsonWriter json_writer_;
+
+    // Heartbeats negotiated in the hello, only touched from the main loop
+    TimerId heartbeat_timer_ = 0;
+    int heartbeat_interval_ms_ = 0;
+    uint32_t heartbeat_sequence_ = 0;
+    uint32_t heartbeat_pending_id_ = 0;
+    int64_t heartbeat_sent_time_ = 0;
+    int heartbeat_misses_ = 0;
+
+    // IoT sync negotiated in the hello
+    bool iot_cbor_ = false;
+    std::string server_iot_version_;
+    size_t iot_bytes_sent_ = 0;
+    CborEncoder cbor_encoder_;
 
     virtual void SendText(const std::string& text) = 0;
+    // Binary control messages, only for transports that can tell them apart from audio
+    virtual bool SupportsBinaryMessages() const { return false; }
+    virtual void SendBinaryMessage(const std::string& data) {}
+    // Send the partially filled aggregated packet, if any
+    virtual void FlushAudio() {}
+    int GetMaxFramesPerPacket() const;
+    void ConfigureFrameAggregation(const cJSON* audio_params, size_t packet_overhead);
+    // Start an outgoing message with the session id and type, leaving the object open
+    JsonWriter& BeginMessage(const char* type);
+    void NegotiateHeartbeat(const cJSON* root);
+    void NegotiateIot(const cJSON* root);
+    void SendIotMessage(JsonWriter& json);
+    void StartHeartbeat();
+    void StopHeartbeat();
+    void OnHeartbeatTimer();
+    void OnPong(uint32_t id, int64_t receive_time);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
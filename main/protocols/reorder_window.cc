@@ -0,0 +1,165 @@
+#include "reorder_window.h"
+#include "audio_buffer_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "ReorderWindow"
+
+ReorderWindow::ReorderWindow(size_t depth, int max_hold_ms) : slots_(depth), max_hold_ms_(max_hold_ms) {
+    esp_timer_create_args_t hold_timer_args = {
+        .callback = [](void* arg) {
+            auto window = (ReorderWindow*)arg;
+            window->OnHoldTimeout();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "reorder_hold_timer",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&hold_timer_args, &hold_timer_);
+}
+
+ReorderWindow::~ReorderWindow() {
+    if (hold_timer_ != nullptr) {
+        esp_timer_stop(hold_timer_);
+        esp_timer_delete(hold_timer_);
+    }
+}
+
+void ReorderWindow::OnRelease(std::function<void(std::vector<uint8_t>&& data)> callback) {
+    on_release_ = callback;
+}
+
+void ReorderWindow::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (esp_timer_is_active(hold_timer_)) {
+        esp_timer_stop(hold_timer_);
+    }
+    for (auto& slot : slots_) {
+        if (slot.used) {
+            AudioBufferPool::GetInstance().Release(std::move(slot.data));
+        }
+        slot.used = false;
+        slot.data.clear();
+    }
+    held_ = 0;
+    next_sequence_ = 0;
+    reordered_ = 0;
+    recovered_ = 0;
+    dropped_ = 0;
+    lost_ = 0;
+}
+
+void ReorderWindow::Push(uint32_t sequence, std::vector<uint8_t>&& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (next_sequence_ == 0) {
+        // The first packet of the stream defines where the sequence starts
+        next_sequence_ = sequence;
+    }
+
+    if (sequence < next_sequence_) {
+        dropped_++;
+        AudioBufferPool::GetInstance().Release(std::move(data));
+        return;
+    }
+
+    // Give up the oldest gaps until the packet fits into the window
+    while (sequence - next_sequence_ >= slots_.size()) {
+        if (held_ == 0) {
+            lost_ += sequence - next_sequence_ - slots_.size() + 1;
+            next_sequence_ = sequence - slots_.size() + 1;
+            break;
+        }
+        SkipGap();
+    }
+
+    if (sequence == next_sequence_) {
+        if (held_ > 0) {
+            recovered_++;
+        }
+        Release(std::move(data));
+        next_sequence_++;
+        DrainInOrder();
+    } else {
+        auto& slot = slots_[sequence % slots_.size()];
+        if (slot.used) {
+            dropped_++;
+            AudioBufferPool::GetInstance().Release(std::move(data));
+            return;
+        }
+        slot.used = true;
+        slot.sequence = sequence;
+        slot.arrival_time = esp_timer_get_time();
+        slot.data = std::move(data);
+        held_++;
+        reordered_++;
+    }
+
+    if (held_ == 0) {
+        if (esp_timer_is_active(hold_timer_)) {
+            esp_timer_stop(hold_timer_);
+        }
+    } else if (!esp_timer_is_active(hold_timer_)) {
+        esp_timer_start_once(hold_timer_, max_hold_ms_ * 1000);
+    }
+}
+
+void ReorderWindow::Release(std::vector<uint8_t>&& data) {
+    if (on_release_ != nullptr) {
+        on_release_(std::move(data));
+    }
+}
+
+void ReorderWindow::DrainInOrder() {
+    while (held_ > 0) {
+        auto& slot = slots_[next_sequence_ % slots_.size()];
+        if (!slot.used || slot.sequence != next_sequence_) {
+            break;
+        }
+        slot.used = false;
+        held_--;
+        Release(std::move(slot.data));
+        next_sequence_++;
+    }
+}
+
+// Give up the missing sequences in front of the first held packet
+void ReorderWindow::SkipGap() {
+    while (held_ > 0) {
+        auto& slot = slots_[next_sequence_ % slots_.size()];
+        if (slot.used && slot.sequence == next_sequence_) {
+            break;
+        }
+        lost_++;
+        next_sequence_++;
+    }
+    DrainInOrder();
+}
+
+void ReorderWindow::OnHoldTimeout() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t max_hold_us = max_hold_ms_ * 1000LL;
+    while (held_ > 0) {
+        // Held packets are within the window, so the first one is found within depth steps
+        const Slot* first = nullptr;
+        for (uint32_t sequence = next_sequence_; first == nullptr; sequence++) {
+            auto& slot = slots_[sequence % slots_.size()];
+            if (slot.used && slot.sequence == sequence) {
+                first = &slot;
+            }
+        }
+
+        int64_t waited = esp_timer_get_time() - first->arrival_time;
+        if (waited < max_hold_us) {
+            esp_timer_start_once(hold_timer_, max_hold_us - waited);
+            return;
+        }
+        SkipGap();
+    }
+}
+
+void ReorderWindow::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ESP_LOGI(TAG, "Reordered: %lu, recovered: %lu, dropped: %lu, lost: %lu",
+        reordered_, recovered_, dropped_, lost_);
+}
@@ -0,0 +1,61 @@
+#ifndef REORDER_WINDOW_H
+#define REORDER_WINDOW_H
+
+#include <esp_timer.h>
+
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+// Sequence-indexed window that holds early packets until the missing ones arrive,
+// and releases packets in order. A gap is given up when the window is full or
+// when a packet has been held longer than max_hold_ms. Packets that are not
+// released go back to the AudioBufferPool.
+class ReorderWindow {
+public:
+    ReorderWindow(size_t depth, int max_hold_ms);
+    ~ReorderWindow();
+
+    void OnRelease(std::function<void(std::vector<uint8_t>&& data)> callback);
+    void Push(uint32_t sequence, std::vector<uint8_t>&& data);
+    void Reset();
+    void PrintStats();
+
+    inline uint32_t reordered() const { return reordered_; }
+    inline uint32_t recovered() const { return recovered_; }
+    inline uint32_t dropped() const { return dropped_; }
+    inline uint32_t lost() const { return lost_; }
+
+private:
+    struct Slot {
+        bool used = false;
+        uint32_t sequence = 0;
+        int64_t arrival_time = 0;
+        std::vector<uint8_t> data;
+    };
+
+    std::mutex mutex_;
+    std::vector<Slot> slots_;
+    size_t held_ = 0;
+    int max_hold_ms_;
+    uint32_t next_sequence_ = 0;
+    esp_timer_handle_t hold_timer_ = nullptr;
+    std::function<void(std::vector<uint8_t>&& data)> on_release_;
+
+    // Packets that arrived ahead of a missing one
+    uint32_t reordered_ = 0;
+    // Missing packets that arrived late but in time to be released in order
+    uint32_t recovered_ = 0;
+    // Packets that arrived after their sequence was given up, or duplicates
+    uint32_t dropped_ = 0;
+    // Sequences that never arrived
+    uint32_t lost_ = 0;
+
+    void Release(std::vector<uint8_t>&& data);
+    void DrainInOrder();
+    void SkipGap();
+    void OnHoldTimeout();
+};
+
+#endif // REORDER_WINDOW_H
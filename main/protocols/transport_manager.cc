@@ -0,0 +1,150 @@
+#include "transport_manager.h"
+#include "settings.h"
+
+#if CONFIG_CONNECTION_TYPE_VE_RTC
+#include "vertc_protocol.h"
+#else
+#include "mqtt_protocol.h"
+#include "websocket_protocol.h"
+#endif
+
+#include <esp_log.h>
+
+#define TAG "TransportManager"
+
+static const char* const TRANSPORT_NAMES[] = {
+    "mqtt",
+    "websocket",
+    "vertc",
+};
+
+TransportType TransportManager::SelectTransport() {
+#if CONFIG_CONNECTION_TYPE_VE_RTC
+    return kTransportVeRtc;
+#else
+    // "active" is set when the device fell back, "preferred" comes from the server
+    Settings settings("transport", true);
+    auto name = settings.GetString("active");
+#if CONFIG_TRANSPORT_FALLBACK
+    // The fallback expires, the network that blocked UDP may have changed since
+    if (!name.empty()) {
+        int boots = settings.GetInt("active_boots");
+        if (boots <= 0) {
+            ESP_LOGI(TAG, "Fallback to %s expired, trying the preferred transport again", name.c_str());
+            settings.EraseKey("active");
+            settings.EraseKey("active_boots");
+            name.clear();
+        } else {
+            settings.SetInt("active_boots", boots - 1);
+        }
+    }
+#endif
+    if (name.empty()) {
+        name = settings.GetString("preferred");
+    }
+    if (name == TRANSPORT_NAMES[kTransportWebsocket]) {
+        return kTransportWebsocket;
+    } else if (name == TRANSPORT_NAMES[kTransportMqttUdp]) {
+        return kTransportMqttUdp;
+    }
+
+#ifdef CONFIG_CONNECTION_TYPE_WEBSOCKET
+    return kTransportWebsocket;
+#else
+    // MQTT cannot connect before the server sent its endpoint, use websocket if the server configured it
+    Settings mqtt("mqtt");
+    Settings websocket("websocket");
+    if (mqtt.GetString("endpoint").empty() && !websocket.GetString("url").empty()) {
+        ESP_LOGW(TAG, "MQTT endpoint is not specified, using websocket");
+        return kTransportWebsocket;
+    }
+    return kTransportMqttUdp;
+#endif
+#endif
+}
+
+std::unique_ptr<Protocol> TransportManager::CreateProtocol() {
+    if (current_ == kTransportCount) {
+        current_ = SelectTransport();
+    }
+    ESP_LOGI(TAG, "Using transport %s", TRANSPORT_NAMES[current_]);
+
+    switch (current_) {
+#if CONFIG_CONNECTION_TYPE_VE_RTC
+    case kTransportVeRtc:
+        return std::make_unique<VeRtcProtocol>();
+#else
+    case kTransportMqttUdp:
+        return std::make_unique<MqttProtocol>();
+    case kTransportWebsocket:
+        return std::make_unique<WebsocketProtocol>();
+#endif
+    default:
+        ESP_LOGE(TAG, "Transport %s is not built in", TRANSPORT_NAMES[current_]);
+        return nullptr;
+    }
+}
+
+void TransportManager::OnOpenResult(bool success, int open_ms) {
+    auto& stats = stats_[current_];
+    stats.attempts++;
+    if (success) {
+        stats.successes++;
+        stats.consecutive_failures = 0;
+        stats.total_open_ms += open_ms;
+        if (open_ms > stats.max_open_ms) {
+            stats.max_open_ms = open_ms;
+        }
+        return;
+    }
+
+    stats.consecutive_failures++;
+#if CONFIG_TRANSPORT_FALLBACK
+    if (current_ == kTransportMqttUdp && stats.consecutive_failures >= CONFIG_TRANSPORT_FALLBACK_THRESHOLD) {
+        ESP_LOGW(TAG, "Failed to open the audio channel %lu times in a row", stats.consecutive_failures);
+        fallback_pending_ = true;
+    }
+#endif
+}
+
+void TransportManager::OnSpeakingFinished(uint32_t audio_packets) {
+    auto& stats = stats_[current_];
+    if (audio_packets > 0) {
+        stats.silent_turns = 0;
+        return;
+    }
+
+    // The server spoke over the control channel but no audio arrived, UDP is most likely blocked
+    stats.silent_turns++;
+#if CONFIG_TRANSPORT_FALLBACK
+    if (current_ == kTransportMqttUdp && stats.silent_turns >= CONFIG_TRANSPORT_FALLBACK_THRESHOLD) {
+        ESP_LOGW(TAG, "No UDP audio received in %lu turns", stats.silent_turns);
+        fallback_pending_ = true;
+    }
+#endif
+}
+
+void TransportManager::Fallback() {
+    fallback_pending_ = false;
+    ESP_LOGW(TAG, "Falling back from %s to websocket", TRANSPORT_NAMES[current_]);
+    current_ = kTransportWebsocket;
+
+    // Remembered for some boots, or until the server config selects a transport again
+    Settings settings("transport", true);
+    settings.SetString("active", TRANSPORT_NAMES[current_]);
+#if CONFIG_TRANSPORT_FALLBACK
+    settings.SetInt("active_boots", CONFIG_TRANSPORT_FALLBACK_BOOTS);
+#endif
+}
+
+void TransportManager::PrintStats() {
+    for (int i = 0; i < kTransportCount; i++) {
+        auto& stats = stats_[i];
+        if (stats.attempts == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: opened %lu/%lu (%lu%%), open time avg %d ms, max %d ms",
+            TRANSPORT_NAMES[i], stats.successes, stats.attempts, stats.successes * 100 / stats.attempts,
+            stats.successes > 0 ? (int)(stats.total_open_ms / stats.successes) : 0, stats.max_open_ms);
+    }
+}
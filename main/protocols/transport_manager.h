@@ -0,0 +1,51 @@
+#ifndef TRANSPORT_MANAGER_H
+#define TRANSPORT_MANAGER_H
+
+#include "protocol.h"
+
+#include <memory>
+#include <cstdint>
+
+enum TransportType {
+    kTransportMqttUdp,
+    kTransportWebsocket,
+    kTransportVeRtc,
+    kTransportCount
+};
+
+struct TransportStats {
+    uint32_t attempts = 0;
+    uint32_t successes = 0;
+    uint32_t consecutive_failures = 0;
+    // Speaking turns in a row that received no downlink audio
+    uint32_t silent_turns = 0;
+    int64_t total_open_ms = 0;
+    int max_open_ms = 0;
+};
+
+// Picks the protocol used to talk to the server. The preferred transport
+// comes from the server config (OTA response) and falls back to Kconfig.
+// When MQTT+UDP keeps failing, or UDP audio never arrives because the
+// network blocks it, the device switches to websocket and remembers it for
+// a number of boots.
+class TransportManager {
+public:
+    std::unique_ptr<Protocol> CreateProtocol();
+    TransportType current() const { return current_; }
+
+    void OnOpenResult(bool success, int open_ms);
+    // A speaking turn ended, audio_packets is the downlink audio received in this session
+    void OnSpeakingFinished(uint32_t audio_packets);
+    bool NeedsFallback() const { return fallback_pending_; }
+    void Fallback();
+    void PrintStats();
+
+private:
+    TransportType current_ = kTransportCount;
+    bool fallback_pending_ = false;
+    TransportStats stats_[kTransportCount];
+
+    TransportType SelectTransport();
+};
+
+#endif // TRANSPORT_MANAGER_H
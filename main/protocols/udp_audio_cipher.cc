@@ -0,0 +1,66 @@
+#include "udp_audio_cipher.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+#define TAG "UdpAudioCipher"
+
+UdpAudioCipher::UdpAudioCipher() {
+    // The context lives as long as the protocol, only the key changes with every hello
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+UdpAudioCipher::~UdpAudioCipher() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool UdpAudioCipher::SetKey(const std::string& key, const std::string& nonce) {
+    if (nonce.size() != sizeof(nonce_)) {
+        ESP_LOGE(TAG, "Invalid nonce size: %zu", nonce.size());
+        return false;
+    }
+    if (mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), key.size() * 8) != 0) {
+        ESP_LOGE(TAG, "Invalid key size: %zu", key.size());
+        return false;
+    }
+    memcpy(nonce_, nonce.data(), sizeof(nonce_));
+    return true;
+}
+
+bool UdpAudioCipher::Encrypt(const uint8_t* data, size_t size, uint32_t sequence, std::string& packet) {
+    packet.resize(sizeof(nonce_) + size);
+    auto header = (uint8_t*)packet.data();
+    memcpy(header, nonce_, sizeof(nonce_));
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[12] = htonl(sequence);
+
+    // mbedtls advances the counter block, so it works on a copy of the header
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, header, sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, nonce_counter, stream_block,
+        data, header + sizeof(nonce_)) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data");
+        return false;
+    }
+    return true;
+}
+
+bool UdpAudioCipher::Decrypt(const uint8_t* packet, size_t size, uint8_t* output) {
+    if (size < sizeof(nonce_)) {
+        return false;
+    }
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, packet, sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, size - sizeof(nonce_), &nc_off, nonce_counter, stream_block,
+        packet + sizeof(nonce_), output);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef UDP_AUDIO_CIPHER_H
+#define UDP_AUDIO_CIPHER_H
+
+#include <mbedtls/aes.h>
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Nonce header in front of every UDP audio packet: type, flags, payload size,
+// timestamp and sequence. It doubles as the initial AES-CTR counter block.
+#define UDP_AUDIO_HEADER_SIZE 16
+
+// AES-CTR encryption of the MQTT+UDP audio packets. The context and the send
+// buffer are reused, so neither direction allocates once the buffers have
+// grown to the packet size.
+class UdpAudioCipher {
+public:
+    UdpAudioCipher();
+    ~UdpAudioCipher();
+
+    // Key and nonce template as raw bytes, from the server hello
+    bool SetKey(const std::string& key, const std::string& nonce);
+    // Builds header and encrypted payload in packet, which keeps its capacity between calls
+    bool Encrypt(const uint8_t* data, size_t size, uint32_t sequence, std::string& packet);
+    // Decrypts the payload of a received packet into output, which holds size - UDP_AUDIO_HEADER_SIZE bytes
+    bool Decrypt(const uint8_t* packet, size_t size, uint8_t* output);
+
+private:
+    mbedtls_aes_context aes_ctx_;
+    uint8_t nonce_[UDP_AUDIO_HEADER_SIZE] = {};
+};
+
+#endif // UDP_AUDIO_CIPHER_H
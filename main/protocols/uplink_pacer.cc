@@ -0,0 +1,145 @@
+#include "uplink_pacer.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "UplinkPacer"
+
+// Back off at most this many frames after repeated send failures
+#define MAX_BACKOFF_FRAMES 8
+
+UplinkPacer::UplinkPacer(int frame_duration_ms, int catch_up_percent, int max_delay_ms)
+    : frame_duration_ms_(frame_duration_ms),
+      send_interval_us_((int64_t)frame_duration_ms * 1000 * 100 / catch_up_percent),
+      max_delay_us_((int64_t)max_delay_ms * 1000) {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto pacer = (UplinkPacer*)arg;
+            // If the task is dropped, the next Push drains instead
+            pacer->timer_armed_ = false;
+            Application::GetInstance().Schedule([pacer]() {
+                pacer->Drain();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "uplink_pacer",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&timer_args, &timer_);
+}
+
+UplinkPacer::~UplinkPacer() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void UplinkPacer::OnSend(std::function<bool(const std::vector<uint8_t>& opus, uint32_t timestamp)> callback) {
+    on_send_ = callback;
+}
+
+void UplinkPacer::Push(std::vector<uint8_t>&& opus, uint32_t timestamp) {
+    int64_t now = esp_timer_get_time();
+    if (!enabled_) {
+        if (on_send_(opus, timestamp)) {
+            sent_frames_++;
+        } else {
+            send_failures_++;
+        }
+        return;
+    }
+
+    queue_.push_back({std::move(opus), timestamp, now});
+    max_queue_depth_ = std::max(max_queue_depth_, queue_.size());
+    DropStale(now);
+    // A frame that arrives at the media rate finds the queue empty and goes out right away
+    if (!timer_armed_) {
+        Drain();
+    }
+}
+
+void UplinkPacer::Drain() {
+    int64_t now = esp_timer_get_time();
+    DropStale(now);
+    if (queue_.empty()) {
+        return;
+    }
+    if (now < next_send_time_) {
+        ArmTimer(next_send_time_ - now);
+        return;
+    }
+
+    if (!SendFront(now)) {
+        // Keep the frame and retry later, the delay budget drops it if the link stays congested
+        send_failures_++;
+        backoff_ms_ = backoff_ms_ == 0 ? frame_duration_ms_ : std::min(backoff_ms_ * 2, frame_duration_ms_ * MAX_BACKOFF_FRAMES);
+        next_send_time_ = now + backoff_ms_ * 1000;
+        ArmTimer(backoff_ms_ * 1000);
+        return;
+    }
+    backoff_ms_ = 0;
+    next_send_time_ = now + send_interval_us_;
+    if (!queue_.empty()) {
+        ArmTimer(send_interval_us_);
+    }
+}
+
+bool UplinkPacer::SendFront(int64_t now) {
+    auto& frame = queue_.front();
+    if (!on_send_(frame.opus, frame.timestamp)) {
+        return false;
+    }
+    int64_t delay = now - frame.queued_time;
+    total_delay_us_ += delay;
+    max_delay_seen_us_ = std::max(max_delay_seen_us_, delay);
+    sent_frames_++;
+    queue_.pop_front();
+    return true;
+}
+
+void UplinkPacer::DropStale(int64_t now) {
+    while (!queue_.empty() && now - queue_.front().queued_time > max_delay_us_) {
+        queue_.pop_front();
+        dropped_frames_++;
+    }
+}
+
+void UplinkPacer::ArmTimer(int64_t delay_us) {
+    if (timer_armed_) {
+        return;
+    }
+    timer_armed_ = true;
+    esp_timer_start_once(timer_, delay_us);
+}
+
+void UplinkPacer::Flush() {
+    int64_t now = esp_timer_get_time();
+    DropStale(now);
+    while (!queue_.empty()) {
+        if (!SendFront(now)) {
+            send_failures_++;
+            dropped_frames_ += queue_.size();
+            queue_.clear();
+            break;
+        }
+    }
+    next_send_time_ = now + send_interval_us_;
+}
+
+void UplinkPacer::Clear() {
+    esp_timer_stop(timer_);
+    timer_armed_ = false;
+    dropped_frames_ += queue_.size();
+    queue_.clear();
+    backoff_ms_ = 0;
+    next_send_time_ = 0;
+}
+
+void UplinkPacer::PrintStats() {
+    ESP_LOGI(TAG, "Sent: %lu, dropped: %lu, send failures: %lu, max queue: %u, queue delay avg %lld ms, max %lld ms",
+        sent_frames_, dropped_frames_, send_failures_, (unsigned)max_queue_depth_,
+        sent_frames_ > 0 ? total_delay_us_ / sent_frames_ / 1000 : 0, max_delay_seen_us_ / 1000);
+}
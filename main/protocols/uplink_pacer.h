@@ -0,0 +1,63 @@
+#ifndef UPLINK_PACER_H
+#define UPLINK_PACER_H
+
+#include <esp_timer.h>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// Sits between the encoder and the transport and sends the uplink audio at
+// the media rate. Bursts (the wake word pre-roll, frames piled up behind a
+// main loop stall) are drained at a bounded catch-up rate, failed sends are
+// retried with exponential back off, and frames that waited longer than
+// the delay budget are dropped, oldest first. Only used on the main loop.
+class UplinkPacer {
+public:
+    UplinkPacer(int frame_duration_ms, int catch_up_percent, int max_delay_ms);
+    ~UplinkPacer();
+
+    void OnSend(std::function<bool(const std::vector<uint8_t>& opus, uint32_t timestamp)> callback);
+    // Without pacing every frame goes to the transport right away
+    void SetEnabled(bool enabled) { enabled_ = enabled; }
+    void Push(std::vector<uint8_t>&& opus, uint32_t timestamp);
+    // Send everything still queued, e.g. before the stop listening message
+    void Flush();
+    void Clear();
+    void PrintStats();
+
+private:
+    struct Frame {
+        std::vector<uint8_t> opus;
+        uint32_t timestamp;
+        int64_t queued_time;
+    };
+
+    std::function<bool(const std::vector<uint8_t>& opus, uint32_t timestamp)> on_send_;
+    std::deque<Frame> queue_;
+    esp_timer_handle_t timer_ = nullptr;
+    bool enabled_ = true;
+    // Cleared by the timer callback itself, a dropped drain task must not leave it set
+    std::atomic<bool> timer_armed_{false};
+    int frame_duration_ms_;
+    int64_t send_interval_us_;
+    int64_t max_delay_us_;
+    int64_t next_send_time_ = 0;
+    int backoff_ms_ = 0;
+
+    uint32_t sent_frames_ = 0;
+    uint32_t dropped_frames_ = 0;
+    uint32_t send_failures_ = 0;
+    size_t max_queue_depth_ = 0;
+    int64_t total_delay_us_ = 0;
+    int64_t max_delay_seen_us_ = 0;
+
+    void Drain();
+    bool SendFront(int64_t now);
+    void DropStale(int64_t now);
+    void ArmTimer(int64_t delay_us);
+};
+
+#endif // UPLINK_PACER_H
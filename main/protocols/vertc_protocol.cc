@@ -13,8 +13,6 @@
 
 static bool joined = false;
 
-static std::function<void(std::vector<uint8_t>&& data)> g_on_incoming_audio = nullptr;
-
 // byte rtc lite callbacks
 static void byte_rtc_on_join_room_success(byte_rtc_engine_t engine, const char* channel, int elapsed_ms, bool something) {
     ESP_LOGI(TAG, "join channel success %s elapsed %d ms now %d ms\n", channel, elapsed_ms, elapsed_ms);
@@ -55,16 +53,11 @@ static void byte_rtc_on_room_error(byte_rtc_engine_t engine, const char* channel
 // remote audio
 static void byte_rtc_on_audio_data(byte_rtc_engine_t engine, const char* channel, const char*  uid , uint16_t sent_ts,
                       audio_codec_type_e codec, const void* data_ptr, size_t data_len){
-    ESP_LOGI(TAG, "byte_rtc_on_audio_data... len %d\n", data_len);
-    ESP_LOGI(TAG, "byte_rtc_on_audio_data... codec type %d\n", codec);
-
-    // engine_context_t* context = (engine_context_t *) byte_rtc_get_user_data(engine);
-    //player_pipeline_write(context->player_pipeline, data_ptr, data_len);
-    // std::vector<uint8_t> data((uint8_t*)data_ptr, (uint8_t*)data_ptr + data_len);
-    // if (g_on_incoming_audio != nullptr && data_ptr != nullptr) {
-    //     g_on_incoming_audio(std::move(data));
-    // }
-
+    if (codec != AUDIO_CODEC_TYPE_OPUS || data_ptr == nullptr || data_len == 0) {
+        return;
+    }
+    engine_context_t* context = (engine_context_t *) byte_rtc_get_user_data(engine);
+    context->protocol->OnRemoteAudio(data_ptr, data_len, sent_ts);
 }
 
 // remote video
@@ -76,13 +69,35 @@ static void byte_rtc_on_video_data(byte_rtc_engine_t engine, const char*  channe
 
 VeRtcProtocol::VeRtcProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    OnIncomingMessage("hello", "", [this](const IncomingMessage& message) {
+        ParseServerHello(message.root);
+    });
     on_incoming_audio_ = nullptr;
+    engine_context_.protocol = this;
+
+    esp_timer_create_args_t remote_audio_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (VeRtcProtocol*)arg;
+            if (protocol->remote_speaking_.exchange(false)) {
+                protocol->SyncTtsState();
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "vertc_remote_audio",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&remote_audio_timer_args, &remote_audio_timer_);
 }
 
 VeRtcProtocol::~VeRtcProtocol() {
     if (websocket_ != nullptr) {
         delete websocket_;
     }
+    if (remote_audio_timer_ != nullptr) {
+        esp_timer_stop(remote_audio_timer_);
+        esp_timer_delete(remote_audio_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -329,13 +344,11 @@ void VeRtcProtocol::Start() {
     // byte_rtc_set_video_codec(engine, VIDEO_CODEC_TYPE_H264);
 
     // 设置上下文，便于在回调中获取上下文中的内容
-    engine_context_t engine_context = {
-        //.player_pipeline = player_pipeline,
-        // .on_incoming_audio = this->on_incoming_audio_,
-        .room_info = roomInfo,
-    };
+    engine_context_.room_info = roomInfo;
     // 将自定义的数据与引擎实例关联起来
-    byte_rtc_set_user_data(engine, &engine_context);
+    byte_rtc_set_user_data(engine, &engine_context_);
+    network_monitor_.Reset();
+    has_remote_audio_ = false;
 
     byte_rtc_room_options_t options;
     options.auto_subscribe_audio = 1; // 接收远端音频
@@ -414,7 +427,7 @@ void VeRtcProtocol::Start() {
     ESP_LOGI(TAG, "............. finished\n");
 }
 
-void VeRtcProtocol::SendAudio(const std::vector<uint8_t>& data) {
+bool VeRtcProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
     // if (websocket_ == nullptr) {
     //     return;
     // }
@@ -426,7 +439,6 @@ void VeRtcProtocol::SendAudio(const std::vector<uint8_t>& data) {
     switch (iSendAudio)
     {
     case 0:
-        ESP_LOGI(TAG, "byte_rtc_send_audio_data successful, data size(%d)!", data.size());  
         break;
     case -1:
         ESP_LOGE(TAG, "byte_rtc_send_audio_data failed: The engine instance is not exist!");  
@@ -439,6 +451,7 @@ void VeRtcProtocol::SendAudio(const std::vector<uint8_t>& data) {
         break;
     }
     // websocket_->Send(data.data(), data.size(), true);
+    return iSendAudio == 0;
 }
 
 void VeRtcProtocol::SendText(const std::string& text) {
@@ -458,6 +471,7 @@ bool VeRtcProtocol::IsAudioChannelOpened() const {
 }
 
 void VeRtcProtocol::CloseAudioChannel() {
+    network_monitor_.PrintStats();
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
@@ -486,21 +500,7 @@ bool VeRtcProtocol::OpenAudioChannel() {
                 on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
             }
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
-            }
-            cJSON_Delete(root);
+            Dispatch(data, len);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -520,14 +520,17 @@ bool VeRtcProtocol::OpenAudioChannel() {
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    websocket_->Send(message);
+    auto& json = json_writer_.Clear().BeginObject()
+        .Add("type", "hello")
+        .Add("version", 1)
+        .Add("transport", "websocket");
+    json.Key("audio_params").BeginObject()
+        .Add("format", "opus")
+        .Add("sample_rate", 16000)
+        .Add("channels", 1)
+        .Add("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject();
+    websocket_->Send(json.EndObject().str());
 
     // Wait for server hello
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, VERTC_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -564,7 +567,52 @@ void VeRtcProtocol::ParseServerHello(const cJSON* root) {
     xEventGroupSetBits(event_group_handle_, VERTC_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
-void VeRtcProtocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
-    on_incoming_audio_ = callback;
-    g_on_incoming_audio = callback;
+void VeRtcProtocol::OnRemoteAudio(const void* data, size_t len, uint16_t sent_ts) {
+    // The engine has no sequence numbers, assume one packet per frame duration of sent_ts (ms)
+    if (has_remote_audio_) {
+        extended_sent_ts_ += (uint16_t)(sent_ts - last_sent_ts_);
+    }
+    last_sent_ts_ = sent_ts;
+    has_remote_audio_ = true;
+    network_monitor_.OnAudioPacket(extended_sent_ts_ / OPUS_FRAME_DURATION_MS, extended_sent_ts_);
+
+    if (!remote_speaking_.exchange(true)) {
+        SyncTtsState();
+    }
+    esp_timer_stop(remote_audio_timer_);
+    esp_timer_start_once(remote_audio_timer_, 500 * 1000);
+
+    // The engine reuses its buffer after the callback, copy once straight into the decode queue entry
+    if (on_incoming_audio_ != nullptr) {
+        auto bytes = (const uint8_t*)data;
+        on_incoming_audio_(std::vector<uint8_t>(bytes, bytes + len));
+    }
+}
+
+void VeRtcProtocol::Dispatch(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(dispatch_mutex_);
+    message_dispatcher_.Dispatch(data, len);
+}
+
+// Feed the same tts start/stop messages as the other protocols through the dispatcher.
+// The engine thread and the timer may schedule this in either order, the main loop
+// always follows the latest remote_speaking_.
+void VeRtcProtocol::SyncTtsState() {
+    Application::GetInstance().Schedule([this, alive = std::weak_ptr<bool>(alive_)]() {
+        if (alive.expired()) {
+            return;
+        }
+        static const char start[] = "{\"type\":\"tts\",\"state\":\"start\"}";
+        static const char stop[] = "{\"type\":\"tts\",\"state\":\"stop\"}";
+        bool speaking = remote_speaking_;
+        if (speaking == tts_speaking_) {
+            return;
+        }
+        tts_speaking_ = speaking;
+        if (speaking) {
+            Dispatch(start, sizeof(start) - 1);
+        } else {
+            Dispatch(stop, sizeof(stop) - 1);
+        }
+    });
 }
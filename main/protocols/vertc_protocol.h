@@ -10,6 +10,9 @@
 
 #include "VolcEngineRTCLite.h"
 
+#include <atomic>
+#include <mutex>
+
 #define VERTC_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
 // 应用ID
@@ -30,10 +33,11 @@ typedef struct {
     char token[257];
 } rtc_room_info_t;
 
+class VeRtcProtocol;
+
 typedef struct {
-    //player_pipeline_handle_t player_pipeline;
-    // 播放管道进行替换成小智方案的音频回调
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio;
+    // 引擎回调通过它把远端音频交给协议对象
+    VeRtcProtocol* protocol;
     rtc_room_info_t* room_info;
     // 远端智能体ID
     char remote_uid[128];
@@ -47,12 +51,12 @@ public:
 
     void Start() override;
     void InitRoomInfo();
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    bool SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
-
-    virtual void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
+    // Called from the engine thread for every remote audio packet
+    void OnRemoteAudio(const void* data, size_t len, uint16_t sent_ts);
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -60,7 +64,23 @@ private:
 
     byte_rtc_engine_t engine = nullptr;
     rtc_room_info_t *roomInfo = nullptr;
-    
+    // Must outlive the engine, which keeps a pointer to it as user data
+    engine_context_t engine_context_ = {};
+    // sent_ts is only 16 bits, extended here to keep the jitter and loss math monotonic
+    uint16_t last_sent_ts_ = 0;
+    uint32_t extended_sent_ts_ = 0;
+    bool has_remote_audio_ = false;
+    // The agent does not send tts messages, its speech is delimited by audio activity.
+    // Set by the engine thread and the timer, followed by tts_speaking_ on the main loop.
+    esp_timer_handle_t remote_audio_timer_ = nullptr;
+    std::atomic<bool> remote_speaking_{false};
+    bool tts_speaking_ = false;
+    // Server messages come from the websocket task, the tts messages from the main loop
+    std::mutex dispatch_mutex_;
+
+    void Dispatch(const char* data, size_t len);
+    void SyncTtsState();
+
     void ParseServerHello(const cJSON* root);
     void SendText(const std::string& text) override;
 };
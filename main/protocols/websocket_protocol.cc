@@ -2,8 +2,11 @@
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
+#include "settings.h"
+#include "audio_buffer_pool.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -13,9 +16,26 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    OnIncomingMessage("hello", "", [this](const IncomingMessage& message) {
+        ParseServerHello(message.root);
+    });
+
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    keep_alive_timer_ = TimerService::GetInstance().Create("ws_keep_alive", CONFIG_HOUSEKEEPING_TIMER_SLACK_MS,
+        [this, alive = std::weak_ptr<bool>(alive_)]() {
+        Application::GetInstance().Schedule([this, alive]() {
+            if (!alive.expired()) {
+                OnKeepAliveTimer();
+            }
+        });
+    });
+#endif
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (keep_alive_timer_ != 0) {
+        TimerService::GetInstance().Delete(keep_alive_timer_);
+    }
     if (websocket_ != nullptr) {
         delete websocket_;
     }
@@ -25,12 +45,118 @@ WebsocketProtocol::~WebsocketProtocol() {
 void WebsocketProtocol::Start() {
 }
 
-void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
+bool WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
+    if (websocket_ == nullptr) {
+        return false;
+    }
+
+    if (frame_aggregator_.enabled()) {
+        return frame_aggregator_.Submit(data, timestamp, [this](const std::vector<uint8_t>& packet, uint32_t first_timestamp) {
+            return SendAudioPacket(packet.data(), packet.size(), first_timestamp);
+        });
+    }
+    return SendAudioPacket(data.data(), data.size(), timestamp);
+}
+
+void WebsocketProtocol::FlushAudio() {
+    if (websocket_ == nullptr || frame_aggregator_.empty()) {
+        return;
+    }
+    auto& packet = frame_aggregator_.packet();
+    SendAudioPacket(packet.data(), packet.size(), frame_aggregator_.timestamp());
+    frame_aggregator_.Clear();
+}
+
+bool WebsocketProtocol::SendAudioPacket(const uint8_t* data, size_t size, uint32_t timestamp) {
+    if (version_ != 2) {
+        return websocket_->Send(data, size, true);
+    }
+
+    // The send buffer is only used by the main loop and keeps its capacity between frames
+    send_buffer_.resize(sizeof(BinaryProtocol2) + size);
+    auto frame = (BinaryProtocol2*)send_buffer_.data();
+    frame->version = htons(version_);
+    frame->type = htons(kBinaryFrameTypeOpus);
+    // A failed send is retried with the same sequence, the server must not see a gap
+    frame->sequence = htonl(local_sequence_ + 1);
+    frame->timestamp = htonl(timestamp);
+    frame->payload_size = htonl(size);
+    memcpy(frame->payload, data, size);
+    if (!websocket_->Send(send_buffer_.data(), send_buffer_.size(), true)) {
+        return false;
+    }
+    local_sequence_++;
+    return true;
+}
+
+// Binary frames of version 1 are always audio, only version 2 frames carry a type
+bool WebsocketProtocol::SupportsBinaryMessages() const {
+    return version_ == 2;
+}
+
+void WebsocketProtocol::SendBinaryMessage(const std::string& data) {
     if (websocket_ == nullptr) {
         return;
     }
+    send_buffer_.resize(sizeof(BinaryProtocol2) + data.size());
+    auto frame = (BinaryProtocol2*)send_buffer_.data();
+    frame->version = htons(version_);
+    frame->type = htons(kBinaryFrameTypeCbor);
+    frame->sequence = 0;
+    frame->timestamp = 0;
+    frame->payload_size = htonl(data.size());
+    memcpy(frame->payload, data.data(), data.size());
+    if (!websocket_->Send(send_buffer_.data(), send_buffer_.size(), true)) {
+        ESP_LOGE(TAG, "Failed to send binary message");
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+}
 
-    websocket_->Send(data.data(), data.size(), true);
+void WebsocketProtocol::ParseBinaryFrame(const uint8_t* data, size_t len) {
+    if (version_ != 2) {
+        DeliverAudio(data, len);
+        return;
+    }
+
+    if (len < sizeof(BinaryProtocol2)) {
+        ESP_LOGE(TAG, "Invalid binary frame size: %zu", len);
+        return;
+    }
+    auto frame = (const BinaryProtocol2*)data;
+    size_t payload_size = ntohl(frame->payload_size);
+    if (ntohs(frame->version) != 2 || payload_size > len - sizeof(BinaryProtocol2)) {
+        ESP_LOGE(TAG, "Invalid binary frame, version: %u, payload size: %zu", ntohs(frame->version), payload_size);
+        return;
+    }
+    if (ntohs(frame->type) != kBinaryFrameTypeOpus) {
+        ESP_LOGW(TAG, "Unsupported binary frame type: %u", ntohs(frame->type));
+        return;
+    }
+
+    uint32_t sequence = ntohl(frame->sequence);
+    network_monitor_.OnAudioPacket(sequence, ntohl(frame->timestamp));
+    if (remote_sequence_ != 0 && sequence != remote_sequence_ + 1) {
+        if (sequence > remote_sequence_) {
+            remote_lost_packets_ += sequence - remote_sequence_ - 1;
+        }
+        ESP_LOGW(TAG, "Received audio frame with sequence %lu, expected %lu, lost %lu",
+            sequence, remote_sequence_ + 1, remote_lost_packets_);
+    }
+    remote_sequence_ = sequence;
+    DeliverAudio(frame->payload, payload_size);
+}
+
+void WebsocketProtocol::DeliverAudio(const uint8_t* data, size_t size) {
+    if (on_incoming_audio_ == nullptr) {
+        return;
+    }
+    // Only with twice the pool in use the receive task waits, the server is then slowed
+    // down by TCP flow control
+    std::vector<uint8_t> buffer;
+    if (!AudioBufferPool::GetInstance().Acquire(data, size, buffer, WEBSOCKET_AUDIO_BUFFER_WAIT_MS)) {
+        return;
+    }
+    on_incoming_audio_(std::move(buffer));
 }
 
 void WebsocketProtocol::SendText(const std::string& text) {
@@ -45,78 +171,149 @@ void WebsocketProtocol::SendText(const std::string& text) {
 }
 
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && !parked_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    StopHeartbeat();
+    network_monitor_.PrintStats();
+    message_dispatcher_.PrintStats();
+    frame_aggregator_.PrintStats();
+    AudioBufferPool::GetInstance().PrintStats();
+    frame_aggregator_.Clear();
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    if (keep_alive_ && !parked_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+        ParkConnection();
+        return;
+    }
+#endif
+
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
     }
+    parked_ = false;
 }
 
-bool WebsocketProtocol::OpenAudioChannel() {
-    if (websocket_ != nullptr) {
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+void WebsocketProtocol::ParkConnection() {
+    // End the conversation on the server but keep the connection for the next one
+    SendText(BeginMessage("goodbye").EndObject().str());
+
+    parked_ = true;
+    parked_time_ = std::chrono::steady_clock::now();
+    TimerService::GetInstance().StartPeriodic(keep_alive_timer_, CONFIG_WEBSOCKET_PING_INTERVAL_SECONDS * 1000);
+    ESP_LOGI(TAG, "Websocket parked for reuse");
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+void WebsocketProtocol::OnKeepAliveTimer() {
+    if (!parked_ || websocket_ == nullptr) {
+        TimerService::GetInstance().Stop(keep_alive_timer_);
+        return;
+    }
+
+    auto idle_seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - parked_time_).count();
+    if (!websocket_->IsConnected() || idle_seconds >= CONFIG_WEBSOCKET_KEEP_ALIVE_IDLE_SECONDS) {
+        ESP_LOGI(TAG, "Closing parked websocket, connected: %d, idle: %lld seconds", websocket_->IsConnected(), idle_seconds);
+        TimerService::GetInstance().Stop(keep_alive_timer_);
         delete websocket_;
+        websocket_ = nullptr;
+        parked_ = false;
+        return;
     }
 
+    websocket_->Ping();
+}
+#endif
+
+bool WebsocketProtocol::OpenAudioChannel() {
+    bool reuse = false;
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    TimerService::GetInstance().Stop(keep_alive_timer_);
+    reuse = parked_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_;
+#endif
+    parked_ = false;
+    keep_alive_ = false;
+    heartbeat_interval_ms_ = 0;
+    network_monitor_.Reset();
+
+    // Every conversation is a new session, also on a reused connection
     error_occurred_ = false;
-    std::string url = CONFIG_WEBSOCKET_URL;
-    std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
-    websocket_ = Board::GetInstance().CreateWebSocket();
-    websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
-
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
-        if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
-            }
-        } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
+    session_id_.clear();
+    version_ = 1;
+    local_sequence_ = 0;
+    remote_sequence_ = 0;
+    remote_lost_packets_ = 0;
+
+    auto handshake_start_time = esp_timer_get_time();
+    if (!reuse) {
+        if (websocket_ != nullptr) {
+            delete websocket_;
+        }
+        // The server config from the OTA response takes precedence over the built-in defaults
+        Settings settings("websocket", false);
+        std::string url = settings.GetString("url", CONFIG_WEBSOCKET_URL);
+        std::string token = "Bearer " + settings.GetString("token", CONFIG_WEBSOCKET_ACCESS_TOKEN);
+        websocket_ = Board::GetInstance().CreateWebSocket();
+        websocket_->SetHeader("Authorization", token.c_str());
+        websocket_->SetHeader("Protocol-Version", "1");
+        websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+        websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+
+        websocket_->OnData([this](const char* data, size_t len, bool binary) {
+            if (binary) {
+                ParseBinaryFrame((const uint8_t*)data, len);
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                message_dispatcher_.Dispatch(data, len);
             }
-            cJSON_Delete(root);
-        }
-        last_incoming_time_ = std::chrono::steady_clock::now();
-    });
+            last_incoming_time_ = std::chrono::steady_clock::now();
+        });
 
-    websocket_->OnDisconnected([this]() {
-        ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
-            on_audio_channel_closed_();
-        }
-    });
+        websocket_->OnDisconnected([this]() {
+            ESP_LOGI(TAG, "Websocket disconnected");
+            if (parked_) {
+                // No conversation is running, the keep-alive timer will clean up
+                return;
+            }
+            if (on_audio_channel_closed_ != nullptr) {
+                on_audio_channel_closed_();
+            }
+        });
 
-    if (!websocket_->Connect(url.c_str())) {
-        ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_FOUND);
-        return false;
+        if (!websocket_->Connect(url.c_str())) {
+            ESP_LOGE(TAG, "Failed to connect to websocket server");
+            SetError(Lang::Strings::SERVER_NOT_FOUND);
+            return false;
+        }
     }
 
-    // Send hello message to describe the client
+    // Send hello message to describe the client, on a reused connection it starts the new session
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
-    websocket_->Send(message);
+    auto& json = json_writer_.Clear().BeginObject()
+        .Add("type", "hello")
+        .Add("version", WEBSOCKET_PROTOCOL_VERSION)
+        .Add("transport", "websocket")
+        .Add("heartbeat_interval", CONFIG_PROTOCOL_HEARTBEAT_INTERVAL_MS)
+        .Add("iot_encoding", "cbor");
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    json.Add("keep_alive", true);
+#endif
+    json.Key("audio_params").BeginObject()
+        .Add("format", "opus")
+        .Add("sample_rate", 16000)
+        .Add("channels", 1)
+        .Add("frame_duration", OPUS_FRAME_DURATION_MS);
+    if (GetMaxFramesPerPacket() > 1) {
+        json.Add("max_frames_per_packet", GetMaxFramesPerPacket());
+    }
+    json.EndObject().EndObject();
+    auto hello_time = esp_timer_get_time();
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    websocket_->Send(json.str());
 
     // Wait for server hello
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
@@ -125,6 +322,21 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    network_monitor_.OnRttSample((esp_timer_get_time() - hello_time) / 1000);
+    int64_t handshake_ms = (esp_timer_get_time() - handshake_start_time) / 1000;
+    if (reuse) {
+        // Only the hello round trip was paid, not the connect, TLS and upgrade
+        reused_count_++;
+        saved_handshake_ms_ += std::max<int64_t>(last_handshake_ms_ - handshake_ms, 0);
+        int64_t uptime_ms = esp_timer_get_time() / 1000;
+        ESP_LOGI(TAG, "Reused websocket, avoided %lu reconnects, %lld ms handshake (%lld ms per day)",
+            reused_count_, saved_handshake_ms_, saved_handshake_ms_ * 86400000 / (uptime_ms > 0 ? uptime_ms : 1));
+    } else {
+        last_handshake_ms_ = handshake_ms;
+        ESP_LOGI(TAG, "Websocket handshake took %lld ms, keep alive: %d", last_handshake_ms_, keep_alive_);
+    }
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    StartHeartbeat();
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -140,6 +352,9 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         return;
     }
 
+    auto session_id = cJSON_GetObjectItem(root, "session_id");
+    session_id_ = cJSON_IsString(session_id) ? session_id->valuestring : "";
+
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (audio_params != NULL) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -148,5 +363,20 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+    // Old servers do not echo the version and keep receiving bare opus frames
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint == 2) {
+        version_ = 2;
+    }
+    NegotiateHeartbeat(root);
+    NegotiateIot(root);
+    // Websocket frame header with mask plus TCP/IP headers, and the binary protocol header
+    ConfigureFrameAggregation(audio_params, 6 + 40 + (version_ == 2 ? sizeof(BinaryProtocol2) : 0));
+
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    // The server accepts reusing this connection for following conversations
+    keep_alive_ = cJSON_IsTrue(cJSON_GetObjectItem(root, "keep_alive"));
+#endif
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
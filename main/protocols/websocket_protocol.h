@@ -7,16 +7,26 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <atomic>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Highest binary protocol version offered in the client hello
+#define WEBSOCKET_PROTOCOL_VERSION 2
+
+// How long the receive task waits for an audio buffer, once the pool and as many
+// heap buffers are in use, before dropping the packet
+#define WEBSOCKET_AUDIO_BUFFER_WAIT_MS 500
+
 class WebsocketProtocol : public Protocol {
 public:
     WebsocketProtocol();
     ~WebsocketProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    bool SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -25,8 +35,35 @@ private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
 
+    // Binary protocol version accepted by the server, version 1 sends bare opus frames
+    int version_ = 1;
+    uint32_t local_sequence_ = 0;
+    uint32_t remote_sequence_ = 0;
+    uint32_t remote_lost_packets_ = 0;
+    std::vector<uint8_t> send_buffer_;
+
+    // Keep-alive: the connection is parked after a conversation and reused by the next one
+    bool keep_alive_ = false;
+    // Also read by the disconnect callback on the websocket task
+    std::atomic<bool> parked_{false};
+    TimerId keep_alive_timer_ = 0;
+    std::chrono::time_point<std::chrono::steady_clock> parked_time_;
+    int64_t last_handshake_ms_ = 0;
+    uint32_t reused_count_ = 0;
+    int64_t saved_handshake_ms_ = 0;
+
     void ParseServerHello(const cJSON* root);
     void SendText(const std::string& text) override;
+    void FlushAudio() override;
+    bool SendAudioPacket(const uint8_t* data, size_t size, uint32_t timestamp);
+    void DeliverAudio(const uint8_t* data, size_t size);
+    bool SupportsBinaryMessages() const override;
+    void SendBinaryMessage(const std::string& data) override;
+    void ParseBinaryFrame(const uint8_t* data, size_t len);
+#if CONFIG_WEBSOCKET_KEEP_ALIVE
+    void ParkConnection();
+    void OnKeepAliveTimer();
+#endif
 };
 
 #endif
@@ -0,0 +1,245 @@
+#include "task_placement.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#define TAG "TaskPlacement"
+
+#if CONFIG_TASK_PLACEMENT_SPLIT_CORES
+#define AUDIO_CORE CONFIG_TASK_PLACEMENT_AUDIO_CORE
+#define SYSTEM_CORE (1 - CONFIG_TASK_PLACEMENT_AUDIO_CORE)
+#define AFE_CORE AUDIO_CORE
+#else
+#define AUDIO_CORE -1
+#define SYSTEM_CORE -1
+#define AFE_CORE 1
+#endif
+
+#if CONFIG_BACKGROUND_REALTIME_CORE >= 0
+#define REALTIME_LANE_CORE CONFIG_BACKGROUND_REALTIME_CORE
+#else
+#define REALTIME_LANE_CORE AUDIO_CORE
+#endif
+
+#if CONFIG_BACKGROUND_BULK_CORE >= 0
+#define BULK_LANE_CORE CONFIG_BACKGROUND_BULK_CORE
+#else
+#define BULK_LANE_CORE SYSTEM_CORE
+#endif
+
+#if CONFIG_TASK_BULK_STACK_IN_PSRAM
+#define BULK_STACK_IN_PSRAM true
+#else
+#define BULK_STACK_IN_PSRAM false
+#endif
+
+#define MIN_STACK_SIZE 2048
+
+TaskPlacement::TaskPlacement()
+    : entries_{
+        {"main_loop", "main_loop", AUDIO_CORE, CONFIG_TASK_AUDIO_PRIORITY, 4096 * 2, false},
+        {"bg_realtime", "bg_realtime", REALTIME_LANE_CORE, CONFIG_BACKGROUND_REALTIME_PRIORITY, 4096 * 8, false},
+        {"bg_bulk", "bg_bulk", BULK_LANE_CORE, 2, 4096 * 2, BULK_STACK_IN_PSRAM},
+        {"detection", "audio_detection", AUDIO_CORE, 2, 4096 * 2, false},
+        {"communication", "audio_communication", AUDIO_CORE, 2, 4096 * 2, false},
+        {"ww_encode", "encode_detect_packets", SYSTEM_CORE, 2, 4096 * 8, true},
+        {"afe", "afe", AFE_CORE, 1, 0, false},
+        {"display", "taskLVGL", SYSTEM_CORE, 1, 0, false},
+        {"dns_refresh", "dns_refresh", SYSTEM_CORE, 1, 3072, false},
+    } {
+    LoadOverrides();
+    for (int i = 0; i < kTaskRoleCount; i++) {
+        Validate((TaskRole)i);
+    }
+}
+
+void TaskPlacement::LoadOverrides() {
+    Settings settings("tasks", false);
+    for (auto& entry : entries_) {
+        auto value = settings.GetString(entry.key);
+        if (value.empty()) {
+            continue;
+        }
+        int core, priority, stack_size, psram;
+        if (sscanf(value.c_str(), "%d,%d,%d,%d", &core, &priority, &stack_size, &psram) != 4 || priority < 0 || stack_size < 0) {
+            corrections_.push_back(std::string(entry.key) + ": ignored malformed override \"" + value + "\"");
+            continue;
+        }
+        // A stack of 0 means the component's default, only the tasks it creates have one
+        if (stack_size == 0 && entry.stack_size != 0) {
+            corrections_.push_back(std::string(entry.key) + ": ignored override without a stack size \"" + value + "\"");
+            continue;
+        }
+        entry.core = core;
+        entry.priority = priority;
+        if (entry.stack_size != 0) {
+            entry.stack_size = stack_size;
+            entry.stack_in_psram = psram != 0;
+        } else if (stack_size != 0 || psram != 0) {
+            corrections_.push_back(std::string(entry.key) + ": stack is set by its component, override stack ignored");
+        }
+        corrections_.push_back(std::string(entry.key) + ": overridden by settings");
+    }
+}
+
+void TaskPlacement::Validate(TaskRole role) {
+    auto& entry = entries_[role];
+    auto note = [this, &entry](const char* message) {
+        corrections_.push_back(std::string(entry.key) + ": " + message);
+    };
+
+    if (entry.core >= portNUM_PROCESSORS) {
+        note("core does not exist on this chip, not pinned");
+        entry.core = -1;
+    }
+    if (entry.priority >= configMAX_PRIORITIES) {
+        note("priority above the maximum, lowered");
+        entry.priority = configMAX_PRIORITIES - 1;
+    }
+    if (entry.stack_size != 0 && entry.stack_size < MIN_STACK_SIZE) {
+        note("stack too small, raised");
+        entry.stack_size = MIN_STACK_SIZE;
+    }
+    if (entry.stack_in_psram) {
+#if !CONFIG_SPIRAM
+        note("no PSRAM, stack moved to internal memory");
+        entry.stack_in_psram = false;
+#else
+        // The task deletes itself, a PSRAM stack would leak every time
+        if (role == kTaskDnsRefresh) {
+            note("short lived task, stack kept in internal memory");
+            entry.stack_in_psram = false;
+        }
+#endif
+    }
+}
+
+BaseType_t TaskPlacement::GetCore(TaskRole role) const {
+    return entries_[role].core < 0 ? tskNO_AFFINITY : entries_[role].core;
+}
+
+bool TaskPlacement::Create(TaskRole role, TaskFunction_t function, void* arg, TaskHandle_t* handle) {
+    auto& entry = entries_[role];
+    if (entry.stack_size == 0) {
+        ESP_LOGE(TAG, "No stack size for %s, it is created by its component", entry.name);
+        return false;
+    }
+    TaskHandle_t task = nullptr;
+    if (entry.stack_in_psram) {
+        auto stack = (StackType_t*)heap_caps_malloc(entry.stack_size, MALLOC_CAP_SPIRAM);
+        auto buffer = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+        if (stack != nullptr && buffer != nullptr) {
+            task = xTaskCreateStaticPinnedToCore(function, entry.name, entry.stack_size, arg, entry.priority,
+                stack, buffer, GetCore(role));
+        }
+        if (task == nullptr) {
+            heap_caps_free(stack);
+            heap_caps_free(buffer);
+        }
+    } else if (xTaskCreatePinnedToCore(function, entry.name, entry.stack_size, arg, entry.priority,
+        &task, GetCore(role)) != pdPASS) {
+        task = nullptr;
+    }
+
+    if (task == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %s", entry.name);
+        return false;
+    }
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    return true;
+}
+
+void TaskPlacement::PrintReport() {
+    uint32_t internal_stacks = 0;
+    ESP_LOGI(TAG, "%-14s %-22s %4s %4s %6s %s", "key", "task", "core", "prio", "stack", "memory");
+    for (auto& entry : entries_) {
+        char core[8];
+        snprintf(core, sizeof(core), "%d", entry.core);
+        ESP_LOGI(TAG, "%-14s %-22s %4s %4u %6lu %s", entry.key, entry.name, entry.core < 0 ? "any" : core,
+            (unsigned)entry.priority, (unsigned long)entry.stack_size,
+            entry.stack_size == 0 ? "default" : (entry.stack_in_psram ? "psram" : "internal"));
+        if (!entry.stack_in_psram) {
+            internal_stacks += entry.stack_size;
+        }
+    }
+    for (auto& correction : corrections_) {
+        ESP_LOGW(TAG, "%s", correction.c_str());
+    }
+
+    // Audio that waits behind the UI or bulk work stutters
+    UBaseType_t lowest_audio = std::min({entries_[kTaskMainLoop].priority, entries_[kTaskBackgroundRealtime].priority});
+    for (auto role : {kTaskDisplay, kTaskBackgroundBulk}) {
+        auto& entry = entries_[role];
+        bool shared_core = entry.core < 0 || entries_[kTaskMainLoop].core < 0 || entry.core == entries_[kTaskMainLoop].core;
+        if (shared_core && entry.priority > lowest_audio) {
+            ESP_LOGW(TAG, "%s runs above the audio tasks on the same core", entry.key);
+        }
+    }
+    ESP_LOGI(TAG, "Internal stacks: %lu bytes, free internal: %u bytes", (unsigned long)internal_stacks,
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+}
+
+void TaskPlacement::PrintCpuProfile() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks() + 5);
+    configRUN_TIME_COUNTER_TYPE run_time;
+    tasks.resize(uxTaskGetSystemState(tasks.data(), tasks.size(), &run_time));
+
+    configRUN_TIME_COUNTER_TYPE elapsed = run_time - last_run_time_;
+    bool first = last_tasks_.empty();
+    auto previous = std::move(last_tasks_);
+    last_tasks_ = tasks;
+    last_run_time_ = run_time;
+    if (first || elapsed == 0) {
+        return;
+    }
+
+    // Run time of each task since the previous call, tasks created since then count in full
+    for (auto& task : tasks) {
+        auto it = std::find_if(previous.begin(), previous.end(), [&task](const TaskStatus_t& p) {
+            return p.xHandle == task.xHandle;
+        });
+        if (it != previous.end()) {
+            task.ulRunTimeCounter -= it->ulRunTimeCounter;
+        }
+    }
+
+    std::string cores;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        auto idle_handle = xTaskGetIdleTaskHandleForCore(core);
+        auto idle = std::find_if(tasks.begin(), tasks.end(), [idle_handle](const TaskStatus_t& t) {
+            return t.xHandle == idle_handle;
+        });
+        int load = idle == tasks.end() ? -1 : 100 - (int)((uint64_t)idle->ulRunTimeCounter * 100 / elapsed);
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), "%score%d %d%%", core == 0 ? "" : ", ", core, load);
+        cores += buffer;
+    }
+    ESP_LOGI(TAG, "CPU load: %s", cores.c_str());
+
+    std::sort(tasks.begin(), tasks.end(), [](const TaskStatus_t& a, const TaskStatus_t& b) {
+        return a.ulRunTimeCounter > b.ulRunTimeCounter;
+    });
+    for (auto& task : tasks) {
+        // Percent of one core
+        int percent = (uint64_t)task.ulRunTimeCounter * 100 / elapsed;
+        if (percent < 1) {
+            break;
+        }
+        if (strncmp(task.pcTaskName, "IDLE", 4) == 0) {
+            continue;
+        }
+        BaseType_t core = xTaskGetCoreID(task.xHandle);
+        ESP_LOGI(TAG, "  %-22s core %-3s prio %2u cpu %3d%% stack free %lu", task.pcTaskName,
+            core == tskNO_AFFINITY ? "any" : (core == 0 ? "0" : "1"), (unsigned)task.uxCurrentPriority,
+            percent, (unsigned long)task.usStackHighWaterMark);
+    }
+#endif
+}
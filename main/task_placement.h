@@ -0,0 +1,80 @@
+#ifndef TASK_PLACEMENT_H
+#define TASK_PLACEMENT_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <vector>
+#include <string>
+#include <mutex>
+
+enum TaskRole {
+    kTaskMainLoop,
+    kTaskBackgroundRealtime,
+    kTaskBackgroundBulk,
+    kTaskAudioDetection,
+    kTaskAudioCommunication,
+    kTaskWakeWordEncode,
+    kTaskAfe,
+    kTaskDisplay,
+    kTaskDnsRefresh,
+    kTaskRoleCount
+};
+
+struct TaskPlacementEntry {
+    // Short name, also the settings key of the override
+    const char* key;
+    // FreeRTOS task name, the profile matches tasks by it
+    const char* name;
+    // Negative to let the scheduler pick a core
+    int core;
+    UBaseType_t priority;
+    // 0 keeps the default of the component that creates the task
+    uint32_t stack_size;
+    bool stack_in_psram;
+};
+
+// Central table of where every task of the firmware runs: core, priority and
+// stack. The defaults come from Kconfig. A string "core,priority,stack,psram"
+// in the NVS namespace "tasks", stored under the entry key, overrides one task
+// without reflashing, e.g. bg_bulk = "0,2,8192,1". A core of -1 leaves the
+// task unpinned. The stack must not be 0 for the tasks created from the table;
+// for afe and display the component sets the stack and only core and
+// priority are taken.
+class TaskPlacement {
+public:
+    static TaskPlacement& GetInstance() {
+        static TaskPlacement instance;
+        return instance;
+    }
+    TaskPlacement(const TaskPlacement&) = delete;
+    TaskPlacement& operator=(const TaskPlacement&) = delete;
+
+    const TaskPlacementEntry& Get(TaskRole role) const { return entries_[role]; }
+    // The core in the form FreeRTOS takes it
+    BaseType_t GetCore(TaskRole role) const;
+    // Creates the task as placed. A PSRAM stack is never freed, use it only
+    // for tasks that live until reboot.
+    bool Create(TaskRole role, TaskFunction_t function, void* arg, TaskHandle_t* handle = nullptr);
+
+    // Logs the table and everything that had to be corrected
+    void PrintReport();
+    // Logs load per core and per task since the previous call
+    void PrintCpuProfile();
+
+private:
+    TaskPlacement();
+
+    TaskPlacementEntry entries_[kTaskRoleCount];
+    // What the validation had to change, for the boot report
+    std::vector<std::string> corrections_;
+
+    std::mutex mutex_;
+    std::vector<TaskStatus_t> last_tasks_;
+    configRUN_TIME_COUNTER_TYPE last_run_time_ = 0;
+
+    void LoadOverrides();
+    void Validate(TaskRole role);
+};
+
+#endif // TASK_PLACEMENT_H
@@ -0,0 +1,256 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <esp_timer.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only callable with inline storage. A callable that does not fit is a
+// compile error, so constructing a task never allocates.
+template <size_t StorageSize>
+class InlineTask {
+public:
+    InlineTask() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+    InlineTask(F&& callable) {
+        using T = std::decay_t<F>;
+        static_assert(sizeof(T) <= StorageSize, "Captured state is too large for an inline task");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Captured state is over-aligned");
+        new (storage_) T(std::forward<F>(callable));
+        invoke_ = [](void* callable) {
+            (*(T*)callable)();
+        };
+        relocate_ = [](void* destination, void* source) {
+            if (destination != nullptr) {
+                new (destination) T(std::move(*(T*)source));
+            }
+            ((T*)source)->~T();
+        };
+    }
+
+    InlineTask(InlineTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    ~InlineTask() {
+        Reset();
+    }
+
+    void operator()() {
+        invoke_(storage_);
+    }
+
+    explicit operator bool() const {
+        return invoke_ != nullptr;
+    }
+
+    void Reset() {
+        if (relocate_ != nullptr) {
+            relocate_(nullptr, storage_);
+            invoke_ = nullptr;
+            relocate_ = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) uint8_t storage_[StorageSize];
+    void (*invoke_)(void* callable) = nullptr;
+    // Move constructs into destination (if any) and destroys source
+    void (*relocate_)(void* destination, void* source) = nullptr;
+
+    void MoveFrom(InlineTask& other) {
+        if (other.relocate_ != nullptr) {
+            other.relocate_(storage_, other.storage_);
+            invoke_ = other.invoke_;
+            relocate_ = other.relocate_;
+            other.invoke_ = nullptr;
+            other.relocate_ = nullptr;
+        }
+    }
+};
+
+// Bounded multi-producer, single-consumer queue on a fixed ring of cells
+// (D. Vyukov's bounded queue). Producers never block and never allocate:
+// TryPush fails when the queue is full and the caller decides what to do.
+template <typename T, size_t Capacity>
+class TaskQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    TaskQueue() {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(T&& item) {
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[position & (Capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                full_count_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->item = std::move(item);
+        cell->enqueue_time = esp_timer_get_time();
+        cell->sequence.store(position + 1, std::memory_order_release);
+
+        // The consumer may already have moved past this item, then the depth is meaningless
+        intptr_t depth = (intptr_t)(position + 1 - dequeue_position_.load(std::memory_order_relaxed));
+        size_t max_depth = max_depth_.load(std::memory_order_relaxed);
+        while (depth > (intptr_t)max_depth &&
+            !max_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    // Only called by the consumer, wait_us receives how long the item was queued
+    bool TryPop(T& item, int64_t* wait_us = nullptr) {
+        size_t position = dequeue_position_.load(std::memory_order_relaxed);
+        Cell& cell = cells_[position & (Capacity - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(position + 1) < 0) {
+            return false;
+        }
+
+        item = std::move(cell.item);
+        int64_t wait_time = esp_timer_get_time() - cell.enqueue_time;
+        total_wait_us_ += wait_time;
+        if (wait_time > max_wait_us_) {
+            max_wait_us_ = wait_time;
+        }
+        pop_count_++;
+        if (wait_us != nullptr) {
+            *wait_us = wait_time;
+        }
+        cell.sequence.store(position + Capacity, std::memory_order_release);
+        dequeue_position_.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t capacity() const { return Capacity; }
+    size_t max_depth() const { return max_depth_.load(std::memory_order_relaxed); }
+    uint32_t full_count() const { return full_count_.load(std::memory_order_relaxed); }
+    uint32_t pop_count() const { return pop_count_; }
+    int64_t average_wait_us() const { return pop_count_ > 0 ? total_wait_us_ / pop_count_ : 0; }
+    int64_t max_wait_us() const { return max_wait_us_; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        int64_t enqueue_time;
+        T item;
+    };
+
+    Cell cells_[Capacity];
+    std::atomic<size_t> enqueue_position_{0};
+    std::atomic<size_t> dequeue_position_{0};
+
+    std::atomic<size_t> max_depth_{0};
+    std::atomic<uint32_t> full_count_{0};
+    // Updated by the consumer only
+    uint32_t pop_count_ = 0;
+    int64_t total_wait_us_ = 0;
+    int64_t max_wait_us_ = 0;
+};
+
+// TaskQueue that never drops an item. While the ring has room pushing is
+// lock-free and does not allocate; when it is full the item spills into a
+// heap list under a mutex. Once something spilled, later items spill too
+// until the consumer took the list, so every producer's items keep their order.
+template <typename T, size_t Capacity>
+class SpillingTaskQueue {
+public:
+    // Returns true if the item was the first to spill since the consumer
+    // last took the list, so overloads can be logged once
+    bool Push(T&& item) {
+        if (!spilled_.load(std::memory_order_acquire) && ring_.TryPush(std::move(item))) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool first = spill_.empty();
+        spill_.push_back(Spilled{std::move(item), esp_timer_get_time()});
+        spill_count_++;
+        spilled_.store(true, std::memory_order_release);
+        return first;
+    }
+
+    // Only called by the consumer. The ring goes first, it only holds items
+    // pushed before the spilled ones
+    bool TryPop(T& item, int64_t* wait_us = nullptr) {
+        if (draining_.empty() && ring_.TryPop(item, wait_us)) {
+            return true;
+        }
+        if (draining_.empty() && spilled_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            draining_.swap(spill_);
+            spilled_.store(false, std::memory_order_release);
+        }
+        if (draining_.empty()) {
+            return false;
+        }
+        item = std::move(draining_.front().item);
+        if (wait_us != nullptr) {
+            *wait_us = esp_timer_get_time() - draining_.front().enqueue_time;
+        }
+        draining_.pop_front();
+        return true;
+    }
+
+    size_t capacity() const { return Capacity; }
+    size_t max_depth() const { return ring_.max_depth(); }
+    uint32_t pop_count() const { return ring_.pop_count(); }
+    int64_t average_wait_us() const { return ring_.average_wait_us(); }
+    int64_t max_wait_us() const { return ring_.max_wait_us(); }
+    // Items that did not fit in the ring
+    uint32_t spill_count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return spill_count_;
+    }
+
+private:
+    struct Spilled {
+        T item;
+        int64_t enqueue_time;
+    };
+
+    TaskQueue<T, Capacity> ring_;
+    std::atomic<bool> spilled_{false};
+    mutable std::mutex mutex_;
+    std::deque<Spilled> spill_;
+    uint32_t spill_count_ = 0;
+    // Spilled items taken by the consumer, only touched by it
+    std::deque<Spilled> draining_;
+};
+
+#endif // TASK_QUEUE_H
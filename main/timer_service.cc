@@ -0,0 +1,217 @@
+#include "timer_service.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <climits>
+
+#define TAG "TimerService"
+
+// Periodic timers start on this grid so that their wake-ups line up
+#define ALIGN_US 1000000
+
+// Set on the esp_timer task while it runs the callbacks
+static thread_local bool in_callback = false;
+
+TimerService::TimerService() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<TimerService*>(arg)->OnTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "timer_service",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+    stats_start_us_ = esp_timer_get_time();
+}
+
+TimerService::Entry* TimerService::Find(TimerId id) {
+    if (id == 0 || id > entries_.size() || entries_[id - 1].name == nullptr) {
+        ESP_LOGE(TAG, "Invalid timer id %lu", (unsigned long)id);
+        return nullptr;
+    }
+    return &entries_[id - 1];
+}
+
+TimerId TimerService::Create(const char* name, uint32_t slack_ms, std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Generation 0 marks a free entry
+    if (++last_generation_ == 0) {
+        last_generation_ = 1;
+    }
+    Entry entry = {name, std::move(callback), last_generation_, false, 0, (int64_t)slack_ms * 1000,
+        (int64_t)slack_ms * 1000, 0, 0, 0};
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].name == nullptr) {
+            entries_[i] = std::move(entry);
+            return i + 1;
+        }
+    }
+    entries_.push_back(std::move(entry));
+    return entries_.size();
+}
+
+void TimerService::Delete(TimerId id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto entry = Find(id);
+    if (entry == nullptr) {
+        return;
+    }
+    *entry = {};
+    Arm(esp_timer_get_time());
+    // On the esp_timer task the running callback is the caller itself, or not this one
+    if (!in_callback) {
+        callback_done_.wait(lock, [this, id]() {
+            return running_id_ != id;
+        });
+    }
+}
+
+void TimerService::StartPeriodic(TimerId id, uint32_t period_ms) {
+    Start(id, (int64_t)period_ms * 1000, (int64_t)period_ms * 1000);
+}
+
+void TimerService::StartOnce(TimerId id, uint32_t timeout_ms) {
+    Start(id, (int64_t)timeout_ms * 1000, 0);
+}
+
+void TimerService::Start(TimerId id, int64_t timeout_us, int64_t period_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = Find(id);
+    if (entry == nullptr) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t due = now + timeout_us;
+    // The first period may be up to one grid step longer
+    if (period_us >= ALIGN_US) {
+        due = (due + ALIGN_US - 1) / ALIGN_US * ALIGN_US;
+    }
+    entry->active = true;
+    entry->period_us = period_us;
+    // A short timer would otherwise run a whole slack late, a heartbeat could be missed
+    entry->slack_us = std::min(entry->max_slack_us, (period_us != 0 ? period_us : timeout_us) / 4);
+    entry->due_us = due;
+    Arm(now);
+}
+
+void TimerService::Stop(TimerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = Find(id);
+    if (entry == nullptr || !entry->active) {
+        return;
+    }
+    entry->active = false;
+    Arm(esp_timer_get_time());
+}
+
+bool TimerService::IsActive(TimerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = Find(id);
+    return entry != nullptr && entry->active;
+}
+
+void TimerService::Arm(int64_t now) {
+    // The earliest time a timer must run by, then wait for every timer due
+    // before it so they all share the wake-up
+    int64_t deadline = INT64_MAX;
+    for (auto& entry : entries_) {
+        if (entry.active) {
+            deadline = std::min(deadline, entry.due_us + entry.slack_us);
+        }
+    }
+    if (deadline == INT64_MAX) {
+        if (armed_us_ != 0) {
+            esp_timer_stop(timer_);
+            armed_us_ = 0;
+        }
+        return;
+    }
+
+    int64_t wake = 0;
+    for (auto& entry : entries_) {
+        if (entry.active && entry.due_us <= deadline) {
+            wake = std::max(wake, entry.due_us);
+        }
+    }
+    if (wake == armed_us_) {
+        return;
+    }
+    esp_timer_stop(timer_);
+    esp_timer_start_once(timer_, std::max<int64_t>(wake - now, 0));
+    armed_us_ = wake;
+}
+
+void TimerService::OnTimer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = esp_timer_get_time();
+        armed_us_ = 0;
+        wake_count_++;
+        for (auto& entry : entries_) {
+            if (!entry.active || entry.due_us > now) {
+                continue;
+            }
+            due_callbacks_.push_back({(TimerId)(&entry - entries_.data() + 1), entry.generation, entry.callback});
+            entry.fire_count++;
+            entry.max_late_us = std::max(entry.max_late_us, (uint32_t)(now - entry.due_us));
+            fire_count_++;
+
+            if (entry.period_us == 0) {
+                entry.active = false;
+            } else {
+                // Keep the phase, periods missed while the task was busy are skipped
+                entry.due_us += entry.period_us;
+                if (entry.due_us <= now) {
+                    entry.due_us += ((now - entry.due_us) / entry.period_us + 1) * entry.period_us;
+                }
+            }
+        }
+        Arm(now);
+    }
+
+    // Without the lock, callbacks may start and stop timers
+    for (auto& due : due_callbacks_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Deleted since it fell due, maybe the id was reused
+            if (entries_[due.id - 1].generation != due.generation) {
+                continue;
+            }
+            running_id_ = due.id;
+        }
+        in_callback = true;
+        due.callback();
+        in_callback = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_id_ = 0;
+        }
+        callback_done_.notify_all();
+    }
+    due_callbacks_.clear();
+}
+
+void TimerService::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - stats_start_us_;
+    if (elapsed <= 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "%lld callbacks in %lld wake-ups per minute", fire_count_ * 60000000LL / elapsed,
+        wake_count_ * 60000000LL / elapsed);
+    for (auto& entry : entries_) {
+        if (entry.name == nullptr || entry.fire_count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "  %-20s %5lu runs, max %lu ms late", entry.name, (unsigned long)entry.fire_count,
+            (unsigned long)(entry.max_late_us / 1000));
+        entry.fire_count = 0;
+        entry.max_late_us = 0;
+    }
+    wake_count_ = 0;
+    fire_count_ = 0;
+    stats_start_us_ = now;
+}
@@ -0,0 +1,98 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <esp_timer.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+// 0 is never a valid timer
+using TimerId = uint32_t;
+
+// One esp_timer shared by the housekeeping timers of the firmware. Every
+// timer has a slack: how late its callback may run, at most a quarter of its
+// period or timeout. A wake-up runs all the timers that are due, and it is put
+// off within the slack so that timers due shortly after can join it. Periodic
+// timers start on a whole second of uptime and keep their phase, so timers
+// with periods of whole seconds always share their wake-ups. Callbacks run on
+// the esp_timer task, like ESP_TIMER_TASK timers do, and must not block.
+//
+// Audio pacing, LED effects and anything else that needs exact timing stays
+// on its own esp_timer.
+class TimerService {
+public:
+    static TimerService& GetInstance() {
+        static TimerService instance;
+        return instance;
+    }
+    TimerService(const TimerService&) = delete;
+    TimerService& operator=(const TimerService&) = delete;
+
+    // Registers a stopped timer
+    TimerId Create(const char* name, uint32_t slack_ms, std::function<void()> callback);
+    // Waits for the callback if it is running on the esp_timer task, unless the
+    // callback deletes its own timer. A callback that fell due but has not
+    // started yet does not run.
+    void Delete(TimerId id);
+    void StartPeriodic(TimerId id, uint32_t period_ms);
+    void StartOnce(TimerId id, uint32_t timeout_ms);
+    void Stop(TimerId id);
+    bool IsActive(TimerId id);
+
+    // Logs callbacks run and wake-ups taken per minute since the previous
+    // call. Without the service every callback would be a wake-up of its own.
+    void PrintStats();
+
+private:
+    TimerService();
+
+    struct Entry {
+        const char* name;
+        std::function<void()> callback;
+        // Tells the entry apart from a deleted timer that had the same id, 0 when free
+        uint32_t generation;
+        bool active;
+        // 0 for a one-shot timer
+        int64_t period_us;
+        // As created, and as clamped for the current period or timeout
+        int64_t max_slack_us;
+        int64_t slack_us;
+        int64_t due_us;
+        uint32_t fire_count;
+        uint32_t max_late_us;
+    };
+
+    std::mutex mutex_;
+    esp_timer_handle_t timer_ = nullptr;
+    // Freed entries are reused, the id is the index plus one
+    std::vector<Entry> entries_;
+    // When timer_ fires, 0 if it is stopped
+    int64_t armed_us_ = 0;
+    uint32_t last_generation_ = 0;
+    // Timer whose callback is running, 0 if none
+    TimerId running_id_ = 0;
+    std::condition_variable callback_done_;
+
+    struct DueCallback {
+        TimerId id;
+        uint32_t generation;
+        std::function<void()> callback;
+    };
+    // Only used on the esp_timer task
+    std::vector<DueCallback> due_callbacks_;
+
+    uint32_t wake_count_ = 0;
+    uint32_t fire_count_ = 0;
+    int64_t stats_start_us_ = 0;
+
+    Entry* Find(TimerId id);
+    void Start(TimerId id, int64_t timeout_us, int64_t period_us);
+    void OnTimer();
+    // Sets timer_ to the next wake-up, called with mutex_ held
+    void Arm(int64_t now);
+};
+
+#endif // TIMER_SERVICE_H
@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+# 本地 WebSocket 替身服务器，实现 docs/websocket.md 中的协议，用于在没有云端服务时调试设备
+import argparse
+import asyncio
+import json
+import struct
+import time
+import uuid
+
+import websockets
+
+FRAME_DURATION_MS = 60
+
+
+def load_p3(path):
+    """读取 P3 文件: [1字节类型, 1字节保留, 2字节长度, Opus数据]"""
+    frames = []
+    with open(path, "rb") as f:
+        while True:
+            header = f.read(4)
+            if len(header) < 4:
+                break
+            _, _, length = struct.unpack(">BBH", header)
+            data = f.read(length)
+            if len(data) < length:
+                break
+            frames.append(data)
+    return frames
+
+
+def now_ms():
+    return int(time.monotonic() * 1000) & 0xFFFFFFFF
+
+
+class Session:
+    def __init__(self, server, websocket):
+        self.server = server
+        self.args = server.args
+        self.websocket = websocket
+        self.session_id = ""
+        self.version = 1
+        self.frames_per_packet = 1
+        self.keep_alive = False
+        self.hello_time = None
+        self.tts_task = None
+        self.send_sequence = 0
+        self.remote_sequence = 0
+        self.lost_frames = 0
+        self.turn = 0
+        self.turn_frames = 0
+        self.turn_bytes = 0
+        self.listen_mode = None
+        self.stop_time = None
+
+    def dropping(self):
+        # 模拟链路静默中断：不再回复也不断开连接
+        if self.args.drop_after is None or self.hello_time is None:
+            return False
+        return time.monotonic() - self.hello_time >= self.args.drop_after
+
+    def log(self, message):
+        print(f"[{self.session_id[:8] or '-'}] {message}", flush=True)
+
+    async def send_json(self, message):
+        if self.dropping():
+            return
+        if self.session_id and "session_id" not in message:
+            message["session_id"] = self.session_id
+        await self.websocket.send(json.dumps(message, ensure_ascii=False))
+
+    async def send_audio(self, opus):
+        if self.dropping():
+            return
+        if self.version == 2:
+            self.send_sequence += 1
+            header = struct.pack(">HHIII", 2, 0, self.send_sequence, now_ms(), len(opus))
+            await self.websocket.send(header + opus)
+        else:
+            await self.websocket.send(opus)
+
+    async def run(self):
+        async for message in self.websocket:
+            if isinstance(message, bytes):
+                self.on_audio(message)
+            else:
+                await self.on_json(message)
+        self.log("disconnected")
+
+    def on_audio(self, data):
+        if self.dropping():
+            return
+        if self.version == 2:
+            if len(data) < 16:
+                self.log(f"invalid frame of {len(data)} bytes")
+                return
+            _, _, sequence, _, size = struct.unpack(">HHIII", data[:16])
+            if self.remote_sequence and sequence != self.remote_sequence + 1:
+                self.lost_frames += max(0, sequence - self.remote_sequence - 1)
+            self.remote_sequence = sequence
+            data = data[16:16 + size]
+        frames = 1
+        if self.frames_per_packet > 1:
+            # 聚合包: 若干个 [uint16 长度][Opus 帧]
+            frames, offset = 0, 0
+            while offset + 2 <= len(data):
+                length = struct.unpack(">H", data[offset:offset + 2])[0]
+                offset += 2 + length
+                frames += 1
+        self.turn_frames += frames
+        self.turn_bytes += len(data)
+
+        # 自动模式下没有 stop 消息，收到足够的音频后直接回复
+        if self.listen_mode in ("auto", "realtime") and self.tts_task is None:
+            if self.turn_frames * FRAME_DURATION_MS >= self.args.auto_reply_after * 1000:
+                self.start_reply()
+
+    async def on_json(self, text):
+        try:
+            message = json.loads(text)
+        except json.JSONDecodeError:
+            self.log(f"invalid json: {text}")
+            return
+        if self.dropping():
+            return
+
+        type_ = message.get("type")
+        if type_ == "hello":
+            await self.on_hello(message)
+        elif type_ == "listen":
+            await self.on_listen(message)
+        elif type_ == "abort":
+            self.log("abort")
+            self.cancel_reply()
+            await self.send_json({"type": "tts", "state": "stop"})
+        elif type_ == "ping":
+            await self.send_json({"type": "pong", "id": message.get("id")})
+        elif type_ == "iot":
+            if "descriptors" in message:
+                names = [d.get("name") for d in message["descriptors"]]
+                self.log(f"iot descriptors: {names}")
+            if "states" in message:
+                self.log(f"iot states: {json.dumps(message['states'], ensure_ascii=False)}")
+        elif type_ == "goodbye":
+            self.log("goodbye")
+            self.cancel_reply()
+            if not self.keep_alive:
+                await self.websocket.close()
+        else:
+            self.log(f"unhandled message: {text}")
+
+    async def on_hello(self, message):
+        self.session_id = str(uuid.uuid4())
+        self.hello_time = time.monotonic()
+        self.send_sequence = 0
+        self.remote_sequence = 0
+        self.lost_frames = 0
+
+        client_audio = message.get("audio_params", {})
+        reply_audio = {"sample_rate": 16000, "frame_duration": FRAME_DURATION_MS}
+        self.version = 2 if message.get("version") == 2 and not self.args.raw else 1
+        self.frames_per_packet = min(client_audio.get("max_frames_per_packet", 1), self.args.frames_per_packet)
+        if self.frames_per_packet > 1:
+            reply_audio["frames_per_packet"] = self.frames_per_packet
+        reply = {
+            "type": "hello",
+            "transport": "websocket",
+            "version": self.version,
+            "audio_params": reply_audio,
+        }
+        self.keep_alive = bool(message.get("keep_alive")) and self.args.keep_alive
+        if self.keep_alive:
+            reply["keep_alive"] = True
+        if "heartbeat_interval" in message and not self.args.no_heartbeat:
+            reply["heartbeat_interval"] = message["heartbeat_interval"]
+        self.log(f"hello from client: {json.dumps(message)}")
+        await self.send_json(reply)
+
+        if self.args.iot_command:
+            await self.send_json({"type": "iot", "commands": [json.loads(self.args.iot_command)]})
+
+    async def on_listen(self, message):
+        state = message.get("state")
+        if state == "start":
+            self.turn += 1
+            self.turn_frames = 0
+            self.turn_bytes = 0
+            self.listen_mode = message.get("mode")
+            self.cancel_reply()
+            self.log(f"turn {self.turn}: listen start, mode {self.listen_mode}")
+        elif state == "stop":
+            self.log(f"turn {self.turn}: listen stop")
+            self.start_reply()
+        elif state == "detect":
+            self.log(f"wake word: {message.get('text')}")
+
+    def start_reply(self):
+        self.stop_time = time.monotonic()
+        self.log(f"turn {self.turn}: received {self.turn_frames} frames, {self.turn_bytes} bytes, lost {self.lost_frames}")
+        self.tts_task = asyncio.create_task(self.reply())
+
+    def cancel_reply(self):
+        if self.tts_task is not None:
+            self.tts_task.cancel()
+            self.tts_task = None
+
+    async def reply(self):
+        await asyncio.sleep(self.args.reply_delay)
+        await self.send_json({"type": "stt", "text": self.args.stt_text})
+        await self.send_json({"type": "llm", "emotion": "happy", "text": "😀"})
+        await self.send_json({"type": "tts", "state": "start"})
+        await self.send_json({"type": "tts", "state": "sentence_start", "text": self.args.tts_text})
+
+        # 以实时速度发送，设备端的播放缓冲与真实服务器一致
+        start = time.monotonic()
+        for i, opus in enumerate(self.server.tts_frames):
+            if i == 0:
+                self.log(f"turn {self.turn}: first audio {int((time.monotonic() - self.stop_time) * 1000)} ms after stop")
+            await self.send_audio(opus)
+            delay = start + (i + 1) * FRAME_DURATION_MS / 1000 - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+
+        await self.send_json({"type": "tts", "state": "sentence_end", "text": self.args.tts_text})
+        await self.send_json({"type": "tts", "state": "stop"})
+        self.log(f"turn {self.turn}: reply finished, {len(self.server.tts_frames)} frames")
+        self.tts_task = None
+
+
+class StandInServer:
+    def __init__(self, args):
+        self.args = args
+        self.tts_frames = load_p3(args.tts_p3) if args.tts_p3 else []
+
+    async def handle(self, websocket, path=None):
+        request = getattr(websocket, "request", None)
+        headers = request.headers if request is not None else websocket.request_headers
+        print(f"connection from {websocket.remote_address}, device {headers.get('Device-Id')}, "
+              f"protocol {headers.get('Protocol-Version')}", flush=True)
+        await Session(self, websocket).run()
+
+    async def serve(self):
+        async with websockets.serve(self.handle, self.args.host, self.args.port, max_size=None):
+            print(f"listening on ws://{self.args.host}:{self.args.port}", flush=True)
+            await asyncio.Future()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local stand-in server for the websocket protocol")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--tts-p3", help="P3 file streamed as the TTS reply")
+    parser.add_argument("--stt-text", default="你好")
+    parser.add_argument("--tts-text", default="你好，我是本地测试服务器")
+    parser.add_argument("--reply-delay", type=float, default=0.3, help="seconds between listen stop and the reply")
+    parser.add_argument("--auto-reply-after", type=float, default=3.0,
+                        help="seconds of uplink audio before replying in auto/realtime mode")
+    parser.add_argument("--raw", action="store_true", help="do not accept binary protocol version 2")
+    parser.add_argument("--frames-per-packet", type=int, default=1, help="max uplink frames per packet to accept")
+    parser.add_argument("--keep-alive", action="store_true", help="accept keep-alive connections")
+    parser.add_argument("--no-heartbeat", action="store_true", help="do not enable heartbeats")
+    parser.add_argument("--drop-after", type=float, help="silently drop all traffic this many seconds after hello")
+    parser.add_argument("--iot-command", help="IoT command JSON sent after hello")
+    args = parser.parse_args()
+
+    try:
+        asyncio.run(StandInServer(args).serve())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,29 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> bytes{0};
+
+AllocCount GetAllocCount() {
+    return {allocations.load(), bytes.load()};
+}
+
+void* operator new(size_t size) {
+    allocations++;
+    bytes += size;
+    if (void* p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
@@ -0,0 +1,15 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Counts operator new calls of the whole process
+struct AllocCount {
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+AllocCount GetAllocCount();
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,49 @@
+// Checks that AudioBufferPool hands out heap buffers instead of blocking
+// while the slots are in use, that those come back on release, and that
+// the receiver only waits once the pool and as many heap buffers are out.
+
+#include "audio_buffer_pool.h"
+#include "expect.h"
+
+#include <cstdio>
+#include <vector>
+
+int main() {
+    auto& pool = AudioBufferPool::GetInstance();
+    const uint8_t packet[100] = {};
+
+    // All slots, then as many heap buffers, without waiting
+    std::vector<std::vector<uint8_t>> held;
+    for (int i = 0; i < 2 * CONFIG_AUDIO_BUFFER_POOL_SLOTS; i++) {
+        std::vector<uint8_t> buffer;
+        EXPECT(pool.Acquire(packet, sizeof(packet), buffer, 0));
+        EXPECT(buffer.size() == sizeof(packet));
+        held.push_back(std::move(buffer));
+    }
+    std::vector<uint8_t> extra;
+    EXPECT(!pool.Acquire(packet, sizeof(packet), extra, 0));
+
+    // A heap buffer coming back makes room again
+    pool.Release(std::move(held.back()));
+    held.pop_back();
+    EXPECT(pool.Acquire(packet, sizeof(packet), extra, 0));
+    held.push_back(std::move(extra));
+
+    // A buffer that never comes back only costs allocations from now on
+    held.erase(held.begin());
+    for (auto& buffer : held) {
+        pool.Release(std::move(buffer));
+    }
+    held.clear();
+    for (int i = 0; i < 2 * CONFIG_AUDIO_BUFFER_POOL_SLOTS - 1; i++) {
+        std::vector<uint8_t> buffer;
+        EXPECT(pool.Acquire(packet, sizeof(packet), buffer, 0));
+        held.push_back(std::move(buffer));
+    }
+    for (auto& buffer : held) {
+        pool.Release(std::move(buffer));
+    }
+    pool.PrintStats();
+
+    return ExpectResult();
+}
@@ -0,0 +1,90 @@
+// Runs one simulated device on the real WebsocketProtocol against a server,
+// usually scripts/stand_in_server/stand_in_server.py:
+//
+//   device_simulator --url ws://127.0.0.1:8000/ --p3 uplink.p3 [--turns N]
+//       [--mode auto|manual] [--wake-word TEXT] [--out reply.p3]
+//
+// Each turn prints one line of key=value pairs for scripts to collect:
+// handshake time, time from the end of the uplink to the first reply frame,
+// reply duration and frame counts. The exit code is 1 if a turn failed.
+//
+// Only the protocol layer runs here. The Application state machine, the
+// audio codec and the opus encoder and decoder are not part of the host
+// build, so the uplink is the recorded opus of the P3 file and the reply is
+// written out as received.
+
+#include "simulated_device.h"
+#include "application.h"
+#include "settings.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    const char* url = "ws://127.0.0.1:8000/";
+    const char* p3_path = nullptr;
+    const char* out_path = nullptr;
+    DeviceScript script;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--url") == 0) {
+            url = argv[i + 1];
+        } else if (strcmp(argv[i], "--p3") == 0) {
+            p3_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--out") == 0) {
+            out_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--turns") == 0) {
+            script.turns = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--wake-word") == 0) {
+            script.wake_word = argv[i + 1];
+        } else if (strcmp(argv[i], "--mode") == 0) {
+            script.mode = strcmp(argv[i + 1], "manual") == 0 ? kListeningModeManualStop : kListeningModeAutoStop;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (p3_path == nullptr) {
+        fprintf(stderr, "usage: %s --p3 uplink.p3 [--url URL] [--turns N] [--mode auto|manual] "
+            "[--wake-word TEXT] [--out reply.p3]\n", argv[0]);
+        return 2;
+    }
+    auto frames = LoadP3Frames(p3_path);
+    if (frames.empty()) {
+        fprintf(stderr, "No frames in %s\n", p3_path);
+        return 2;
+    }
+    script.uplink_frames = &frames;
+    script.iot_states = R"([{"name":"Speaker","state":{"volume":70}}])";
+
+    // Where the firmware keeps the server from the OTA response
+    Settings("websocket", true).SetString("url", url);
+
+    FILE* out = nullptr;
+    if (out_path != nullptr && (out = fopen(out_path, "wb")) == nullptr) {
+        fprintf(stderr, "Cannot write %s\n", out_path);
+        return 2;
+    }
+
+    int failed_turns = 0;
+    SimulatedDevice device(1, script, [&](const TurnResult& result) {
+        printf("turn=%d open_ms=%lld response_ms=%lld tts_ms=%lld uplink_frames=%d downlink_frames=%d error=\"%s\"\n",
+            result.turn, (long long)result.open_ms, (long long)result.response_ms, (long long)result.tts_ms,
+            result.uplink_frames, result.downlink_frames, result.error.c_str());
+        fflush(stdout);
+        if (!result.error.empty()) {
+            failed_turns++;
+        }
+    });
+    device.SetReplyOutput(out);
+
+    auto& app = Application::GetInstance();
+    app.Schedule([&]() { device.Start(0); });
+    while (!device.finished()) {
+        app.RunFor(100);
+    }
+    if (out != nullptr) {
+        fclose(out);
+    }
+    return failed_turns == 0 ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+#ifndef EXPECT_H
+#define EXPECT_H
+
+#include <cstdio>
+
+// Checks shared by the host tests. A failed check is reported with its place
+// and counted, the test goes on; main returns ExpectResult().
+inline int expect_failures = 0;
+
+#define EXPECT(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            expect_failures++; \
+        } \
+    } while (0)
+
+// The exit code of the test
+inline int ExpectResult() {
+    if (expect_failures > 0) {
+        fprintf(stderr, "%d checks failed\n", expect_failures);
+        return 1;
+    }
+    return 0;
+}
+
+#endif // EXPECT_H
@@ -0,0 +1,158 @@
+// Replays the messages of a session through cJSON with malloc, as the
+// protocols parsed them before, and through MessageDispatcher with its
+// JsonArena. Reports heap allocations per message and the peak heap held by
+// cJSON for both. Then dispatches from several threads on one dispatcher
+// while another thread parses without an arena, like ThingManager or the OTA
+// check do, and checks that every message still comes out intact.
+//
+//   json_arena_replay <session.jsonl>
+//
+// malloc and free are wrapped at link time to count the calls.
+
+#include "message_dispatcher.h"
+
+#include <malloc.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void __real_free(void* ptr);
+
+static std::atomic<uint64_t> malloc_count{0};
+static std::atomic<int64_t> heap_in_use{0};
+static std::atomic<int64_t> heap_peak{0};
+
+extern "C" void* __wrap_malloc(size_t size) {
+    void* ptr = __real_malloc(size);
+    if (ptr != nullptr) {
+        malloc_count++;
+        int64_t in_use = heap_in_use += malloc_usable_size(ptr);
+        int64_t peak = heap_peak.load();
+        while (in_use > peak && !heap_peak.compare_exchange_weak(peak, in_use)) {
+        }
+    }
+    return ptr;
+}
+
+extern "C" void __wrap_free(void* ptr) {
+    if (ptr != nullptr) {
+        heap_in_use -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
+
+struct HeapStats {
+    double allocations_per_message;
+    int64_t peak_bytes;
+};
+
+template <typename Parse>
+static HeapStats Measure(const std::vector<std::string>& messages, Parse parse) {
+    uint64_t allocations = malloc_count;
+    int64_t base = heap_in_use;
+    heap_peak = base;
+    for (auto& message : messages) {
+        parse(message);
+    }
+    return {double(malloc_count - allocations) / messages.size(), heap_peak - base};
+}
+
+// Type of the last message dispatched on this thread
+static thread_local std::string dispatched_type;
+
+static void RegisterAll(MessageDispatcher& dispatcher) {
+    for (auto type : {"hello", "iot", "stt", "llm", "tts", "pong", "goodbye"}) {
+        dispatcher.Register(type, "", [](const IncomingMessage& message) {
+            dispatched_type = std::string(message.type) + "/" + std::string(message.text);
+        });
+    }
+}
+
+static std::string ExpectedType(const std::string& message) {
+    cJSON* root = cJSON_ParseWithLength(message.data(), message.size());
+    auto type = cJSON_GetObjectItem(root, "type");
+    auto text = cJSON_GetObjectItem(root, "text");
+    std::string expected = std::string(type->valuestring) + "/" + (cJSON_IsString(text) ? text->valuestring : "");
+    cJSON_Delete(root);
+    return expected;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <session.jsonl>\n", argv[0]);
+        return 2;
+    }
+    std::vector<std::string> messages;
+    std::ifstream file(argv[1]);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            messages.push_back(line);
+        }
+    }
+    if (messages.empty()) {
+        fprintf(stderr, "No messages in %s\n", argv[1]);
+        return 2;
+    }
+
+    MessageDispatcher dispatcher;
+    RegisterAll(dispatcher);
+
+    auto before = Measure(messages, [](const std::string& message) {
+        cJSON* root = cJSON_ParseWithLength(message.data(), message.size());
+        cJSON_Delete(root);
+    });
+    auto after = Measure(messages, [&dispatcher](const std::string& message) {
+        dispatcher.Dispatch(message.data(), message.size());
+    });
+    printf("%zu messages\n", messages.size());
+    printf("malloc: %6.2f allocations/message, peak %lld bytes\n", before.allocations_per_message,
+        (long long)before.peak_bytes);
+    printf("arena:  %6.2f allocations/message, peak %lld bytes\n", after.allocations_per_message,
+        (long long)after.peak_bytes);
+
+    std::vector<std::string> expected;
+    for (auto& message : messages) {
+        expected.push_back(ExpectedType(message));
+    }
+    std::atomic<int> corrupted{0};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([&]() {
+            for (int round = 0; round < 2000; round++) {
+                for (size_t i = 0; i < messages.size(); i++) {
+                    if (!dispatcher.Dispatch(messages[i].data(), messages[i].size()) ||
+                        dispatched_type != expected[i]) {
+                        corrupted++;
+                    }
+                }
+            }
+        });
+    }
+    std::thread unscoped([&]() {
+        while (!done) {
+            for (size_t i = 0; i < messages.size(); i++) {
+                if (ExpectedType(messages[i]) != expected[i]) {
+                    corrupted++;
+                }
+            }
+        }
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    unscoped.join();
+    printf("concurrent: %d corrupted messages\n", corrupted.load());
+
+    if (after.allocations_per_message != 0 || corrupted != 0) {
+        return 1;
+    }
+    return 0;
+}
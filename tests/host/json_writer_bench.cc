@@ -0,0 +1,111 @@
+// Checks JsonWriter output and escaping, then compares building the
+// protocol control messages with std::string concatenation, as Protocol did
+// before, against a reused JsonWriter: time and heap allocations per message.
+
+#include "json_writer.h"
+#include "alloc_counter.h"
+#include "expect.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#define MESSAGE_COUNT 1000000
+
+static void ExpectJson(const std::string& actual, const char* expected) {
+    if (actual != expected) {
+        fprintf(stderr, "expected %s\n     got %s\n", expected, actual.c_str());
+        expect_failures++;
+    }
+}
+
+static void TestOutput() {
+    JsonWriter json;
+    json.BeginObject().Add("session_id", "").Add("type", "listen").Add("state", "start").EndObject();
+    ExpectJson(json.str(), R"({"session_id":"","type":"listen","state":"start"})");
+
+    json.Clear().BeginObject().Add("text", "say \"hi\"\\\n\t\x01").EndObject();
+    ExpectJson(json.str(), R"({"text":"say \"hi\"\\\n\t\u0001"})");
+
+    // UTF-8 passes through unchanged
+    json.Clear().BeginObject().Add("text", "你好小智").EndObject();
+    ExpectJson(json.str(), "{\"text\":\"你好小智\"}");
+
+    json.Clear().BeginObject().Add("n", -42).Add("ok", false).Key("a").BeginArray()
+        .Int(1).Raw("{\"x\":1}").BeginObject().EndObject().EndArray().AddRaw("states", "[]").EndObject();
+    ExpectJson(json.str(), R"({"n":-42,"ok":false,"a":[1,{"x":1},{}],"states":[]})");
+}
+
+static const std::string session_id = "8f3c2a1e-5b7d-4c9e-a0f1-2d3e4f5a6b7c";
+static const std::string wake_word = "你好小智";
+static const std::string states = R"([{"name":"Speaker","state":{"volume":70}}])";
+
+// The message builders of Protocol before JsonWriter
+static size_t BuildWithConcatenation() {
+    size_t size = 0;
+    {
+        std::string message = "{\"session_id\":\"" + session_id + "\"";
+        message += ",\"type\":\"listen\",\"state\":\"start\"";
+        message += ",\"mode\":\"auto\"";
+        message += "}";
+        size += message.size();
+    }
+    {
+        std::string message = "{\"session_id\":\"" + session_id +
+            "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
+        size += message.size();
+    }
+    {
+        std::string message = "{\"session_id\":\"" + session_id + "\",\"type\":\"abort\"";
+        message += ",\"reason\":\"wake_word_detected\"";
+        message += "}";
+        size += message.size();
+    }
+    {
+        std::string message = "{\"session_id\":\"" + session_id + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+        size += message.size();
+    }
+    return size;
+}
+
+static size_t BuildWithWriter(JsonWriter& json) {
+    size_t size = 0;
+    json.Clear().BeginObject().Add("session_id", session_id).Add("type", "listen")
+        .Add("state", "start").Add("mode", "auto").EndObject();
+    size += json.str().size();
+    json.Clear().BeginObject().Add("session_id", session_id).Add("type", "listen")
+        .Add("state", "detect").Add("text", wake_word).EndObject();
+    size += json.str().size();
+    json.Clear().BeginObject().Add("session_id", session_id).Add("type", "abort")
+        .Add("reason", "wake_word_detected").EndObject();
+    size += json.str().size();
+    json.Clear().BeginObject().Add("session_id", session_id).Add("type", "iot")
+        .Add("update", true).AddRaw("states", states).EndObject();
+    size += json.str().size();
+    return size;
+}
+
+template <typename Build>
+static void Measure(const char* name, Build build) {
+    auto allocs = GetAllocCount();
+    auto start = std::chrono::steady_clock::now();
+    size_t size = 0;
+    for (int i = 0; i < MESSAGE_COUNT / 4; i++) {
+        size += build();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto end_allocs = GetAllocCount();
+    printf("%-14s %10.1f ns/message %8.2f allocs/message %8.1f bytes/message (%zu)\n", name,
+        seconds * 1e9 / MESSAGE_COUNT, double(end_allocs.allocations - allocs.allocations) / MESSAGE_COUNT,
+        double(end_allocs.bytes - allocs.bytes) / MESSAGE_COUNT, size);
+}
+
+int main() {
+    TestOutput();
+
+    Measure("concatenation", BuildWithConcatenation);
+    JsonWriter json;
+    Measure("JsonWriter", [&json]() { return BuildWithWriter(json); });
+
+    return ExpectResult();
+}
@@ -0,0 +1,136 @@
+// Runs many simulated devices on the real WebsocketProtocol against one
+// server, to load test a backend with the traffic of the firmware:
+//
+//   load_generator --url ws://HOST:PORT/ --p3 uplink.p3 [--devices N]
+//       [--turns N] [--ramp-ms MS] [--mode auto|manual] [--verbose 1]
+//
+// Every device says the wake word, streams the P3 file, plays back the reply
+// and sends its IoT states, then starts the next turn. The devices share one
+// main loop, like the tasks of the firmware share theirs. Opening the audio
+// channel blocks the loop until the server hello, so under load the open
+// time includes waiting for the opens of other devices. Prints latency
+// percentiles and the error rate per kind; the exit code is 1 if more than
+// --max-error-rate percent of the turns failed.
+
+#include "simulated_device.h"
+#include "application.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+
+static void PrintPercentiles(const char* name, std::vector<int64_t> values) {
+    if (values.empty()) {
+        printf("%-12s no samples\n", name);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](int p) {
+        size_t rank = (values.size() * p + 99) / 100;
+        return (long long)values[rank > 0 ? rank - 1 : 0];
+    };
+    printf("%-12s p50 %6lld  p90 %6lld  p99 %6lld  max %6lld ms\n", name,
+        percentile(50), percentile(90), percentile(99), (long long)values.back());
+}
+
+int main(int argc, char** argv) {
+    const char* url = "ws://127.0.0.1:8000/";
+    const char* p3_path = nullptr;
+    int device_count = 10;
+    int ramp_ms = 1000;
+    int max_error_rate = 0;
+    bool verbose = false;
+    DeviceScript script;
+    script.wake_word = "你好小智";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--url") == 0) {
+            url = argv[i + 1];
+        } else if (strcmp(argv[i], "--p3") == 0) {
+            p3_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--devices") == 0) {
+            device_count = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--turns") == 0) {
+            script.turns = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--ramp-ms") == 0) {
+            ramp_ms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--max-error-rate") == 0) {
+            max_error_rate = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = atoi(argv[i + 1]) != 0;
+        } else if (strcmp(argv[i], "--mode") == 0) {
+            script.mode = strcmp(argv[i + 1], "manual") == 0 ? kListeningModeManualStop : kListeningModeAutoStop;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (p3_path == nullptr || device_count <= 0) {
+        fprintf(stderr, "usage: %s --p3 uplink.p3 [--url URL] [--devices N] [--turns N] [--ramp-ms MS] "
+            "[--mode auto|manual] [--max-error-rate PERCENT] [--verbose 1]\n", argv[0]);
+        return 2;
+    }
+    auto frames = LoadP3Frames(p3_path);
+    if (frames.empty()) {
+        fprintf(stderr, "No frames in %s\n", p3_path);
+        return 2;
+    }
+    script.uplink_frames = &frames;
+    script.iot_states = R"([{"name":"Speaker","state":{"volume":70}}])";
+    Settings("websocket", true).SetString("url", url);
+
+    // Only touched from the main loop
+    std::vector<TurnResult> results;
+    auto on_turn = [&](const TurnResult& result) {
+        if (verbose) {
+            printf("device=%d turn=%d open_ms=%lld response_ms=%lld tts_ms=%lld downlink_frames=%d error=\"%s\"\n",
+                result.device, result.turn, (long long)result.open_ms, (long long)result.response_ms,
+                (long long)result.tts_ms, result.downlink_frames, result.error.c_str());
+        }
+        results.push_back(result);
+    };
+
+    std::vector<std::unique_ptr<SimulatedDevice>> devices;
+    for (int i = 0; i < device_count; i++) {
+        devices.push_back(std::make_unique<SimulatedDevice>(i + 1, script, on_turn));
+    }
+
+    auto& app = Application::GetInstance();
+    int64_t start_time = esp_timer_get_time();
+    app.Schedule([&]() {
+        // Spread the first connects over the ramp
+        for (int i = 0; i < device_count; i++) {
+            devices[i]->Start((int64_t)ramp_ms * i / device_count);
+        }
+    });
+    while (std::any_of(devices.begin(), devices.end(), [](auto& device) { return !device->finished(); })) {
+        app.RunFor(100);
+    }
+    int64_t elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+
+    std::vector<int64_t> open_ms, response_ms, tts_ms;
+    std::map<std::string, int> errors;
+    int failed = 0;
+    for (auto& result : results) {
+        if (!result.error.empty()) {
+            errors[result.error]++;
+            failed++;
+            continue;
+        }
+        open_ms.push_back(result.open_ms);
+        response_ms.push_back(result.response_ms);
+        tts_ms.push_back(result.tts_ms);
+    }
+    printf("%d devices, %zu turns in %lld ms, %d failed (%.1f%%)\n", device_count, results.size(),
+        (long long)elapsed_ms, failed, results.empty() ? 0.0 : 100.0 * failed / results.size());
+    PrintPercentiles("open", open_ms);
+    PrintPercentiles("response", response_ms);
+    PrintPercentiles("tts", tts_ms);
+    for (auto& error : errors) {
+        printf("error %-20s %d (%.1f%%)\n", error.first.c_str(), error.second, 100.0 * error.second / results.size());
+    }
+    return failed * 100 <= max_error_rate * (int)results.size() ? 0 : 1;
+}
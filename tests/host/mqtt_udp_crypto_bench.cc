@@ -0,0 +1,104 @@
+// Receive path of MQTT+UDP audio: decrypt, reorder and hand back the buffer
+// after decoding. Compares a heap buffer per packet with decrypting into the
+// AudioBufferPool slot, and fails if the pooled path allocates.
+
+#include "udp_audio_cipher.h"
+#include "reorder_window.h"
+#include "audio_buffer_pool.h"
+#include "alloc_counter.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define PACKET_COUNT 200000
+
+static std::vector<std::string> BuildStream(UdpAudioCipher& cipher) {
+    std::vector<std::string> packets;
+    packets.reserve(PACKET_COUNT);
+    std::vector<uint8_t> opus(400);
+    for (size_t i = 0; i < opus.size(); i++) {
+        opus[i] = i * 7;
+    }
+    for (uint32_t sequence = 1; sequence <= PACKET_COUNT; sequence++) {
+        // Opus frames of 60 ms vary between roughly 100 and 400 bytes
+        size_t size = 100 + sequence * 37 % 300;
+        std::string packet;
+        cipher.Encrypt(opus.data(), size, sequence, packet);
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+struct Result {
+    double packets_per_second;
+    double allocations_per_packet;
+    double bytes_per_packet;
+};
+
+template <typename Receive>
+static Result Run(const std::vector<std::string>& packets, Receive receive) {
+    auto allocs = GetAllocCount();
+    auto start = std::chrono::steady_clock::now();
+    for (auto& packet : packets) {
+        receive(packet);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto end_allocs = GetAllocCount();
+    return {
+        packets.size() / seconds,
+        double(end_allocs.allocations - allocs.allocations) / packets.size(),
+        double(end_allocs.bytes - allocs.bytes) / packets.size(),
+    };
+}
+
+int main() {
+    UdpAudioCipher cipher;
+    cipher.SetKey(std::string(16, '\x5a'), std::string("\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16));
+    auto packets = BuildStream(cipher);
+
+    auto& pool = AudioBufferPool::GetInstance();
+    size_t decoded = 0;
+    ReorderWindow window(CONFIG_UDP_REORDER_WINDOW_DEPTH, CONFIG_UDP_REORDER_MAX_HOLD_MS);
+    window.OnRelease([&](std::vector<uint8_t>&& opus) {
+        // The decoder is done with the packet
+        decoded += opus.size();
+        pool.Release(std::move(opus));
+    });
+
+    auto heap = Run(packets, [&](const std::string& data) {
+        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+        std::vector<uint8_t> opus(data.size() - UDP_AUDIO_HEADER_SIZE);
+        cipher.Decrypt((const uint8_t*)data.data(), data.size(), opus.data());
+        window.Push(sequence, std::move(opus));
+    });
+
+    window.Reset();
+    auto pooled = Run(packets, [&](const std::string& data) {
+        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+        std::vector<uint8_t> opus;
+        if (!pool.Acquire(data.size() - UDP_AUDIO_HEADER_SIZE, opus, 0)) {
+            return;
+        }
+        if (!cipher.Decrypt((const uint8_t*)data.data(), data.size(), opus.data())) {
+            pool.Release(std::move(opus));
+            return;
+        }
+        window.Push(sequence, std::move(opus));
+    });
+
+    printf("%-14s %12s %14s %14s\n", "path", "packets/s", "allocs/packet", "bytes/packet");
+    printf("%-14s %12.0f %14.2f %14.1f\n", "heap buffer", heap.packets_per_second,
+        heap.allocations_per_packet, heap.bytes_per_packet);
+    printf("%-14s %12.0f %14.2f %14.1f\n", "pooled buffer", pooled.packets_per_second,
+        pooled.allocations_per_packet, pooled.bytes_per_packet);
+    printf("decoded %zu bytes\n", decoded);
+
+    if (pooled.allocations_per_packet != 0) {
+        fprintf(stderr, "pooled receive path allocates\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Runs the heartbeat of Protocol against an in-process stand-in server on
+// the simulated clock. The server answers pings like scripts/stand_in_server
+// does, and can start dropping all traffic silently, like a dead link. Checks
+// that the dead link is detected within (misses + 1) intervals plus the timer
+// slack, and that a healthy link with a slow server is left alone.
+
+#include "protocol.h"
+#include "application.h"
+#include "assets/lang_config.h"
+#include "expect.h"
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+
+struct Delivery {
+    int64_t time_us;
+    std::string json;
+};
+
+class StandInProtocol : public Protocol {
+public:
+    int rtt_ms = 40;
+    bool dropping = false;
+    bool opened = false;
+    int pings = 0;
+    int64_t closed_time_us = 0;
+    std::string error;
+
+    void Start() override {}
+
+    // Takes the hello answer of the server, as the transports do
+    bool Open(const char* server_hello) {
+        cJSON* root = cJSON_Parse(server_hello);
+        NegotiateHeartbeat(root);
+        cJSON_Delete(root);
+        opened = true;
+        closed_time_us = 0;
+        StartHeartbeat();
+        return true;
+    }
+
+    bool OpenAudioChannel() override {
+        return Open(R"({"type":"hello","heartbeat_interval":1000})");
+    }
+
+    void CloseAudioChannel() override {
+        StopHeartbeat();
+        opened = false;
+        closed_time_us = esp_timer_get_time();
+    }
+
+    bool IsAudioChannelOpened() const override {
+        return opened;
+    }
+
+    bool SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override {
+        return true;
+    }
+
+    // Delivers the server messages that are due
+    void Poll() {
+        while (!inbox_.empty() && inbox_.front().time_us <= esp_timer_get_time()) {
+            auto json = std::move(inbox_.front().json);
+            inbox_.pop_front();
+            message_dispatcher_.Dispatch(json.data(), json.size());
+        }
+    }
+
+protected:
+    void SendText(const std::string& text) override {
+        if (dropping) {
+            return;
+        }
+        cJSON* root = cJSON_Parse(text.c_str());
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (cJSON_IsString(type) && strcmp(type->valuestring, "ping") == 0) {
+            pings++;
+            auto id = cJSON_GetObjectItem(root, "id");
+            inbox_.push_back({esp_timer_get_time() + rtt_ms * 1000LL,
+                "{\"type\":\"pong\",\"id\":" + std::to_string(id->valueint) + "}"});
+        }
+        cJSON_Delete(root);
+    }
+
+    void SetError(const std::string& message) override {
+        error = message;
+    }
+
+private:
+    std::deque<Delivery> inbox_;
+};
+
+// Advances the clock in main loop sized steps, running timers, deliveries and main loop tasks
+static void Run(StandInProtocol& protocol, int ms) {
+    for (int elapsed = 0; elapsed < ms; elapsed += 10) {
+        HostAdvanceTime(10000);
+        protocol.Poll();
+        Application::GetInstance().RunPending();
+    }
+}
+
+static void TestHealthyLink() {
+    StandInProtocol protocol;
+    protocol.OpenAudioChannel();
+    Run(protocol, 60000);
+    EXPECT(protocol.opened);
+    EXPECT(protocol.pings >= 55);
+    EXPECT(protocol.error.empty());
+    // Pong round trips feed the RTT estimate
+    int rtt_ms = protocol.GetNetworkQuality().rtt_ms;
+    EXPECT(rtt_ms >= 30 && rtt_ms <= 60);
+    protocol.CloseAudioChannel();
+}
+
+static void TestSlowServer() {
+    // Pongs that arrive within the interval are not misses
+    StandInProtocol protocol;
+    protocol.rtt_ms = 800;
+    protocol.OpenAudioChannel();
+    Run(protocol, 30000);
+    EXPECT(protocol.opened);
+    protocol.CloseAudioChannel();
+}
+
+static void TestDeadLink() {
+    StandInProtocol protocol;
+    protocol.OpenAudioChannel();
+    Run(protocol, 10000);
+    protocol.dropping = true;
+    int64_t drop_time_us = esp_timer_get_time();
+    Run(protocol, 10000);
+
+    EXPECT(!protocol.opened);
+    EXPECT(protocol.error == Lang::Strings::SERVER_TIMEOUT);
+    int64_t detect_ms = (protocol.closed_time_us - drop_time_us) / 1000;
+    int64_t bound_ms = (CONFIG_PROTOCOL_HEARTBEAT_MAX_MISSES + 1) * 1000 + CONFIG_HOUSEKEEPING_TIMER_SLACK_MS;
+    printf("dead link detected after %lld ms (bound %lld ms)\n", (long long)detect_ms, (long long)bound_ms);
+    EXPECT(protocol.closed_time_us != 0 && detect_ms <= bound_ms);
+}
+
+static void TestNoHeartbeatNegotiated() {
+    // A server that does not announce heartbeats gets no pings
+    StandInProtocol protocol;
+    protocol.Open(R"({"type":"hello"})");
+    Run(protocol, 10000);
+    EXPECT(protocol.pings == 0);
+    EXPECT(protocol.opened);
+    protocol.CloseAudioChannel();
+}
+
+int main() {
+    TestHealthyLink();
+    TestSlowServer();
+    TestDeadLink();
+    TestNoHeartbeatNegotiated();
+    return ExpectResult();
+}
@@ -0,0 +1,179 @@
+// Replays UDP arrival traces through ReorderWindow on the simulated clock.
+// The fixed cases check the counters exactly, the trace files check that
+// packets come out in order and that every sequence is either released,
+// dropped or counted as lost.
+//
+//   reorder_window_replay [trace.txt ...]
+//
+// A trace has one "<arrival_ms> <sequence>" line per received packet.
+
+#include "reorder_window.h"
+#include "expect.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Arrival {
+    double time_ms;
+    uint32_t sequence;
+};
+
+struct Replay {
+    std::vector<uint32_t> released;
+    uint32_t reordered;
+    uint32_t recovered;
+    uint32_t dropped;
+    uint32_t lost;
+};
+
+static Replay Run(const std::vector<Arrival>& arrivals, size_t depth = 4, int max_hold_ms = 120) {
+    Replay replay = {};
+    ReorderWindow window(depth, max_hold_ms);
+    window.OnRelease([&replay](std::vector<uint8_t>&& data) {
+        uint32_t sequence;
+        memcpy(&sequence, data.data(), sizeof(sequence));
+        replay.released.push_back(sequence);
+    });
+
+    int64_t now_us = esp_timer_get_time();
+    int64_t start_us = now_us;
+    for (auto& arrival : arrivals) {
+        int64_t at = start_us + (int64_t)(arrival.time_ms * 1000);
+        if (at > now_us) {
+            HostAdvanceTime(at - now_us);
+            now_us = at;
+        }
+        std::vector<uint8_t> data(sizeof(arrival.sequence));
+        memcpy(data.data(), &arrival.sequence, sizeof(arrival.sequence));
+        window.Push(arrival.sequence, std::move(data));
+    }
+    // Let the hold timer give up whatever is still waiting for a gap
+    HostAdvanceTime(max_hold_ms * 2000LL);
+
+    replay.reordered = window.reordered();
+    replay.recovered = window.recovered();
+    replay.dropped = window.dropped();
+    replay.lost = window.lost();
+    return replay;
+}
+
+static std::vector<Arrival> Sequence(std::initializer_list<uint32_t> sequences) {
+    std::vector<Arrival> arrivals;
+    double time_ms = 0;
+    for (auto sequence : sequences) {
+        arrivals.push_back({time_ms, sequence});
+        time_ms += 20;
+    }
+    return arrivals;
+}
+
+static void CheckAccounting(const std::vector<Arrival>& arrivals, const Replay& replay) {
+    for (size_t i = 1; i < replay.released.size(); i++) {
+        EXPECT(replay.released[i] > replay.released[i - 1]);
+    }
+    // Every packet pushed is released or dropped once the window is drained
+    EXPECT(replay.released.size() + replay.dropped == arrivals.size());
+    if (!replay.released.empty()) {
+        uint32_t span = replay.released.back() - replay.released.front() + 1;
+        EXPECT(replay.released.size() + replay.lost == span);
+    }
+}
+
+static void TestInOrder() {
+    auto replay = Run(Sequence({1, 2, 3, 4, 5}));
+    EXPECT((replay.released == std::vector<uint32_t>{1, 2, 3, 4, 5}));
+    EXPECT(replay.reordered == 0 && replay.dropped == 0 && replay.lost == 0);
+}
+
+static void TestSwappedPairs() {
+    auto arrivals = Sequence({1, 3, 2, 4, 6, 5});
+    auto replay = Run(arrivals);
+    EXPECT((replay.released == std::vector<uint32_t>{1, 2, 3, 4, 5, 6}));
+    EXPECT(replay.reordered == 2);
+    EXPECT(replay.recovered == 2);
+    EXPECT(replay.lost == 0);
+    CheckAccounting(arrivals, replay);
+}
+
+static void TestGapGivenUpAfterHold() {
+    // 3 never comes in time, 4 is released once the hold time is over and 3 is dropped
+    std::vector<Arrival> arrivals = {{0, 1}, {20, 2}, {40, 4}, {400, 3}, {420, 5}};
+    auto replay = Run(arrivals);
+    EXPECT((replay.released == std::vector<uint32_t>{1, 2, 4, 5}));
+    EXPECT(replay.lost == 1);
+    EXPECT(replay.dropped == 1);
+    CheckAccounting(arrivals, replay);
+}
+
+static void TestGapGivenUpWhenFull() {
+    auto arrivals = Sequence({1, 3, 4, 5, 6});
+    auto replay = Run(arrivals);
+    EXPECT((replay.released == std::vector<uint32_t>{1, 3, 4, 5, 6}));
+    EXPECT(replay.lost == 1);
+    CheckAccounting(arrivals, replay);
+}
+
+static void TestDuplicates() {
+    auto arrivals = Sequence({1, 2, 2, 4, 4, 3});
+    auto replay = Run(arrivals);
+    EXPECT((replay.released == std::vector<uint32_t>{1, 2, 3, 4}));
+    EXPECT(replay.dropped == 2);
+    CheckAccounting(arrivals, replay);
+}
+
+static void TestJumpAhead() {
+    // A jump far beyond the window loses the sequences in between
+    auto arrivals = Sequence({1, 2, 100, 101});
+    auto replay = Run(arrivals);
+    EXPECT((replay.released == std::vector<uint32_t>{1, 2, 100, 101}));
+    EXPECT(replay.lost == 97);
+    CheckAccounting(arrivals, replay);
+}
+
+static bool ReplayTrace(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    std::vector<Arrival> arrivals;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        Arrival arrival;
+        if (!(fields >> arrival.time_ms >> arrival.sequence)) {
+            fprintf(stderr, "%s: bad line: %s\n", path, line.c_str());
+            return false;
+        }
+        arrivals.push_back(arrival);
+    }
+
+    int before = expect_failures;
+    auto replay = Run(arrivals, CONFIG_UDP_REORDER_WINDOW_DEPTH, CONFIG_UDP_REORDER_MAX_HOLD_MS);
+    CheckAccounting(arrivals, replay);
+    printf("%s: %zu packets, released %zu, reordered %" PRIu32 ", recovered %" PRIu32
+        ", dropped %" PRIu32 ", lost %" PRIu32 "\n", path, arrivals.size(), replay.released.size(),
+        replay.reordered, replay.recovered, replay.dropped, replay.lost);
+    return expect_failures == before;
+}
+
+int main(int argc, char* argv[]) {
+    TestInOrder();
+    TestSwappedPairs();
+    TestGapGivenUpAfterHold();
+    TestGapGivenUpWhenFull();
+    TestDuplicates();
+    TestJumpAhead();
+    for (int i = 1; i < argc; i++) {
+        ReplayTrace(argv[i]);
+    }
+    return ExpectResult();
+}
@@ -0,0 +1,226 @@
+#include "simulated_device.h"
+#include "application.h"
+#include "audio_buffer_pool.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+
+#define TAG "SimulatedDevice"
+
+SimulatedDevice::SimulatedDevice(int id, const DeviceScript& script, std::function<void(const TurnResult&)> on_turn)
+    : id_(id), script_(script), on_turn_(on_turn) {
+    char mac_address[18];
+    snprintf(mac_address, sizeof(mac_address), "02:00:00:%02x:%02x:%02x", (id >> 16) & 0xff, (id >> 8) & 0xff, id & 0xff);
+    mac_address_ = mac_address;
+
+    esp_timer_create_args_t audio_timer_args = {
+        .callback = [](void* arg) {
+            auto device = static_cast<SimulatedDevice*>(arg);
+            device->Schedule([device]() { device->OnAudioTick(); });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sim_audio",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&audio_timer_args, &audio_timer_);
+
+    esp_timer_create_args_t turn_timer_args = {
+        .callback = [](void* arg) {
+            auto device = static_cast<SimulatedDevice*>(arg);
+            device->Schedule([device]() {
+                if (device->state_ == kTurnIdle) {
+                    device->StartTurn();
+                } else {
+                    device->EndTurn("timeout");
+                }
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sim_turn",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&turn_timer_args, &turn_timer_);
+    // The websocket callbacks tag their events with the turn of the connection
+    protocol_ = std::make_unique<WebsocketProtocol>();
+    protocol_->OnIncomingMessage("tts", "start", [this](const IncomingMessage& message) {
+        int turn = turn_;
+        Schedule([this, turn]() {
+            if (turn == turn_) {
+                OnTtsStart();
+            }
+        });
+    });
+    protocol_->OnIncomingMessage("tts", "stop", [this](const IncomingMessage& message) {
+        int turn = turn_;
+        Schedule([this, turn]() {
+            if (turn == turn_) {
+                OnTtsStop();
+            }
+        });
+    });
+    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
+        int turn = turn_;
+        Schedule([this, turn, data = std::move(data)]() mutable {
+            if (turn == turn_) {
+                OnAudio(std::move(data));
+            } else {
+                AudioBufferPool::GetInstance().Release(std::move(data));
+            }
+        });
+    });
+    protocol_->OnNetworkError([this](const std::string& message) {
+        int turn = turn_;
+        Schedule([this, turn, message]() {
+            if (turn == turn_ && state_ != kTurnIdle) {
+                EndTurn(message);
+            }
+        });
+    });
+    protocol_->OnAudioChannelClosed([this]() {
+        int turn = turn_;
+        Schedule([this, turn]() {
+            if (turn == turn_ && state_ != kTurnIdle) {
+                EndTurn("channel closed");
+            }
+        });
+    });
+}
+
+SimulatedDevice::~SimulatedDevice() {
+    esp_timer_stop(audio_timer_);
+    esp_timer_stop(turn_timer_);
+    esp_timer_delete(audio_timer_);
+    esp_timer_delete(turn_timer_);
+}
+
+void SimulatedDevice::Schedule(std::function<void()> callback) {
+    Application::GetInstance().Schedule(std::move(callback));
+}
+
+void SimulatedDevice::Start(int delay_ms) {
+    esp_timer_start_once(turn_timer_, (uint64_t)delay_ms * 1000);
+}
+
+void SimulatedDevice::StartTurn() {
+    turn_++;
+    result_ = {};
+    result_.device = id_;
+    result_.turn = turn_;
+    next_frame_ = 0;
+    uplink_end_us_ = 0;
+    tts_start_us_ = 0;
+
+    // The protocol reads the MAC address in OpenAudioChannel, on this thread
+    SystemInfo::SetMacAddress(mac_address_);
+    state_ = kTurnListening;
+    esp_timer_start_once(turn_timer_, (uint64_t)script_.turn_timeout_ms * 1000);
+    int64_t open_start = esp_timer_get_time();
+    if (!protocol_->OpenAudioChannel()) {
+        EndTurn("open failed");
+        return;
+    }
+    result_.open_ms = (esp_timer_get_time() - open_start) / 1000;
+
+    if (!script_.wake_word.empty()) {
+        protocol_->SendWakeWordDetected(script_.wake_word);
+    }
+    protocol_->SendStartListening(script_.mode);
+    esp_timer_start_periodic(audio_timer_, OPUS_FRAME_DURATION_MS * 1000);
+}
+
+void SimulatedDevice::OnAudioTick() {
+    if (state_ != kTurnListening) {
+        return;
+    }
+    auto& frames = *script_.uplink_frames;
+    if (next_frame_ < frames.size()) {
+        uint32_t timestamp = next_frame_ * OPUS_FRAME_DURATION_MS;
+        if (protocol_->SendAudio(frames[next_frame_], timestamp)) {
+            next_frame_++;
+            result_.uplink_frames++;
+            uplink_end_us_ = esp_timer_get_time();
+        }
+        return;
+    }
+
+    // Out of recorded audio, in manual mode the user releases the button
+    esp_timer_stop(audio_timer_);
+    if (script_.mode == kListeningModeManualStop) {
+        protocol_->SendStopListening();
+        uplink_end_us_ = esp_timer_get_time();
+    }
+    state_ = kTurnWaitingReply;
+}
+
+void SimulatedDevice::OnTtsStart() {
+    if (state_ != kTurnListening && state_ != kTurnWaitingReply) {
+        return;
+    }
+    esp_timer_stop(audio_timer_);
+    tts_start_us_ = esp_timer_get_time();
+    state_ = kTurnSpeaking;
+}
+
+void SimulatedDevice::OnAudio(std::vector<uint8_t>&& opus) {
+    if (state_ == kTurnSpeaking) {
+        if (result_.downlink_frames == 0 && uplink_end_us_ != 0) {
+            result_.response_ms = (esp_timer_get_time() - uplink_end_us_) / 1000;
+        }
+        result_.downlink_frames++;
+        if (reply_output_ != nullptr) {
+            BinaryProtocol3 header = {0, 0, htons((uint16_t)opus.size())};
+            fwrite(&header, sizeof(header), 1, reply_output_);
+            fwrite(opus.data(), 1, opus.size(), reply_output_);
+        }
+    }
+    AudioBufferPool::GetInstance().Release(std::move(opus));
+}
+
+void SimulatedDevice::OnTtsStop() {
+    if (state_ != kTurnSpeaking) {
+        return;
+    }
+    result_.tts_ms = (esp_timer_get_time() - tts_start_us_) / 1000;
+    if (!script_.iot_states.empty()) {
+        protocol_->SendIotStates(script_.iot_states);
+    }
+    EndTurn("");
+}
+
+void SimulatedDevice::EndTurn(const std::string& error) {
+    esp_timer_stop(audio_timer_);
+    esp_timer_stop(turn_timer_);
+    state_ = kTurnIdle;
+    result_.error = error;
+    protocol_->CloseAudioChannel();
+    if (on_turn_ != nullptr) {
+        on_turn_(result_);
+    }
+
+    if (turn_ < script_.turns) {
+        esp_timer_start_once(turn_timer_, (uint64_t)script_.turn_gap_ms * 1000);
+    } else {
+        finished_ = true;
+    }
+}
+
+std::vector<std::vector<uint8_t>> LoadP3Frames(const char* path) {
+    std::vector<std::vector<uint8_t>> frames;
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return frames;
+    }
+    BinaryProtocol3 header;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        std::vector<uint8_t> frame(ntohs(header.payload_size));
+        if (fread(frame.data(), 1, frame.size(), file) != frame.size()) {
+            break;
+        }
+        frames.push_back(std::move(frame));
+    }
+    fclose(file);
+    return frames;
+}
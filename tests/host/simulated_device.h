@@ -0,0 +1,101 @@
+#ifndef SIMULATED_DEVICE_H
+#define SIMULATED_DEVICE_H
+
+#include "websocket_protocol.h"
+
+#include <esp_timer.h>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Result of one conversation turn, times in milliseconds
+struct TurnResult {
+    int device = 0;
+    int turn = 0;
+    // Empty when the turn completed
+    std::string error;
+    int64_t open_ms = 0;
+    // From the listen stop, or the last uplink frame in auto mode, to the
+    // first TTS frame. In auto mode the server decides when the user stopped
+    // talking and the device streams until tts start, so only manual mode
+    // measures the server.
+    int64_t response_ms = 0;
+    // From tts start to tts stop
+    int64_t tts_ms = 0;
+    int uplink_frames = 0;
+    int downlink_frames = 0;
+};
+
+struct DeviceScript {
+    const std::vector<std::vector<uint8_t>>* uplink_frames = nullptr;
+    ListeningMode mode = kListeningModeAutoStop;
+    // Send a wake word detect before listening starts, like the wake word path
+    std::string wake_word;
+    // Sent after every reply, empty to skip
+    std::string iot_states;
+    int turns = 1;
+    int turn_gap_ms = 1000;
+    int turn_timeout_ms = 30000;
+};
+
+// One device on top of the real WebsocketProtocol. Like the firmware, the
+// device only touches the protocol from the main loop of the Application
+// stub: the websocket and timer callbacks schedule their work there, so
+// many devices can share one loop. A turn opens the audio channel, streams
+// the uplink frames paced like the audio input, waits for the reply and
+// closes the channel. The protocol is kept for all turns, like the one of
+// the Application.
+class SimulatedDevice {
+public:
+    SimulatedDevice(int id, const DeviceScript& script, std::function<void(const TurnResult&)> on_turn);
+    ~SimulatedDevice();
+
+    // Call from the main loop
+    void Start(int delay_ms);
+    bool finished() const { return finished_; }
+    // Received TTS frames are appended in P3 format
+    void SetReplyOutput(FILE* file) { reply_output_ = file; }
+
+private:
+    enum TurnState {
+        kTurnIdle,
+        kTurnListening,
+        kTurnWaitingReply,
+        kTurnSpeaking
+    };
+
+    int id_;
+    DeviceScript script_;
+    std::function<void(const TurnResult&)> on_turn_;
+    std::unique_ptr<WebsocketProtocol> protocol_;
+    std::string mac_address_;
+    FILE* reply_output_ = nullptr;
+
+    esp_timer_handle_t audio_timer_ = nullptr;
+    esp_timer_handle_t turn_timer_ = nullptr;
+    TurnState state_ = kTurnIdle;
+    // Events of earlier turns that are still queued are ignored. Read by the
+    // websocket callbacks, a closed connection delivers its last events
+    // before CloseAudioChannel returns.
+    std::atomic<int> turn_{0};
+    bool finished_ = false;
+    TurnResult result_;
+    size_t next_frame_ = 0;
+    int64_t uplink_end_us_ = 0;
+    int64_t tts_start_us_ = 0;
+
+    void Schedule(std::function<void()> callback);
+    void StartTurn();
+    void OnAudioTick();
+    void OnTtsStart();
+    void OnTtsStop();
+    void OnAudio(std::vector<uint8_t>&& opus);
+    void EndTurn(const std::string& error);
+};
+
+// Reads the opus frames of a P3 file, empty if it cannot be read
+std::vector<std::vector<uint8_t>> LoadP3Frames(const char* path);
+
+#endif // SIMULATED_DEVICE_H
@@ -0,0 +1,62 @@
+#ifndef HOST_APPLICATION_H
+#define HOST_APPLICATION_H
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#define OPUS_FRAME_DURATION_MS 60
+
+// Stand-in for the firmware Application: only the main loop task queue that
+// the protocols schedule their work on. The test or simulator decides on
+// which thread and when the tasks run.
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    template <typename F>
+    void Schedule(F&& callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.emplace_back(std::forward<F>(callback));
+        task_added_.notify_one();
+    }
+
+    // Runs the tasks scheduled so far, returns how many ran
+    int RunPending() {
+        int count = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!tasks_.empty()) {
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task();
+            count++;
+            lock.lock();
+        }
+        return count;
+    }
+
+    // Waits up to timeout_ms for a task, then runs what is queued
+    int RunFor(int timeout_ms) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_added_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() {
+                return !tasks_.empty();
+            });
+        }
+        return RunPending();
+    }
+
+private:
+    Application() = default;
+
+    std::mutex mutex_;
+    std::condition_variable task_added_;
+    std::deque<std::function<void()>> tasks_;
+};
+
+#endif // HOST_APPLICATION_H
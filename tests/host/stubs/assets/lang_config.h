@@ -0,0 +1,15 @@
+#ifndef HOST_LANG_CONFIG_H
+#define HOST_LANG_CONFIG_H
+
+// The strings of the generated lang_config.h that the host-built modules use
+namespace Lang {
+    constexpr const char* CODE = "en-US";
+
+    namespace Strings {
+        constexpr const char* SERVER_ERROR = "Sending failed, please check the network";
+        constexpr const char* SERVER_NOT_FOUND = "Looking for available service";
+        constexpr const char* SERVER_TIMEOUT = "Waiting for response timeout";
+    }
+}
+
+#endif // HOST_LANG_CONFIG_H
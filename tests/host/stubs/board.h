@@ -0,0 +1,24 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include "web_socket.h"
+
+#include <string>
+
+// Stand-in for the firmware Board, a Wi-Fi board without hardware
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board instance;
+        return instance;
+    }
+
+    std::string GetBoardType() { return "wifi"; }
+    std::string GetUuid() { return "00000000-0000-4000-8000-000000000000"; }
+    WebSocket* CreateWebSocket() { return new WebSocket(); }
+
+private:
+    Board() = default;
+};
+
+#endif // HOST_BOARD_H
@@ -0,0 +1,26 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <cstdio>
+
+// Warnings and errors go to stderr unless HOST_LOG_QUIET, the rest only with HOST_LOG_VERBOSE
+#define HOST_LOG(level, tag, fmt, ...) fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+// Disabled levels still see their arguments, so nothing becomes unused
+#define HOST_LOG_OFF(level, tag, fmt, ...) do { if (0) HOST_LOG(level, tag, fmt, ##__VA_ARGS__); } while (0)
+#ifdef HOST_LOG_QUIET
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG_OFF("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG_OFF("W", tag, fmt, ##__VA_ARGS__)
+#else
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG("W", tag, fmt, ##__VA_ARGS__)
+#endif
+#ifdef HOST_LOG_VERBOSE
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG("D", tag, fmt, ##__VA_ARGS__)
+#else
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG_OFF("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG_OFF("D", tag, fmt, ##__VA_ARGS__)
+#endif
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG_OFF("V", tag, fmt, ##__VA_ARGS__)
+
+#endif // HOST_ESP_LOG_H
@@ -0,0 +1,102 @@
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool active;
+    int64_t due_us;
+    int64_t period_us;
+};
+
+static std::recursive_mutex timer_mutex;
+static int64_t now_us = 0;
+static std::vector<esp_timer*> timers;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    auto timer = new esp_timer{create_args->callback, create_args->arg, false, 0, 0};
+    timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    if (timer->active) {
+        return ESP_FAIL;
+    }
+    timer->active = true;
+    timer->due_us = now_us + timeout_us;
+    timer->period_us = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    if (timer->active) {
+        return ESP_FAIL;
+    }
+    timer->active = true;
+    timer->due_us = now_us + period_us;
+    timer->period_us = period_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    if (!timer->active) {
+        return ESP_FAIL;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    return timer->active;
+}
+
+int64_t esp_timer_get_time() {
+    std::lock_guard<std::recursive_mutex> lock(timer_mutex);
+    return now_us;
+}
+
+void HostAdvanceTime(int64_t us) {
+    std::unique_lock<std::recursive_mutex> lock(timer_mutex);
+    int64_t end = now_us + us;
+    while (true) {
+        // Earliest due timer first, like the esp_timer task
+        esp_timer* next = nullptr;
+        for (auto timer : timers) {
+            if (timer->active && timer->due_us <= end && (next == nullptr || timer->due_us < next->due_us)) {
+                next = timer;
+            }
+        }
+        if (next == nullptr) {
+            break;
+        }
+        now_us = std::max(now_us, next->due_us);
+        if (next->period_us == 0) {
+            next->active = false;
+        } else {
+            next->due_us += next->period_us;
+        }
+        auto callback = next->callback;
+        auto arg = next->arg;
+        lock.unlock();
+        callback(arg);
+        lock.lock();
+    }
+    now_us = end;
+}
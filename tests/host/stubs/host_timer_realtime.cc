@@ -0,0 +1,135 @@
+// esp_timer on the wall clock, for programs that talk to a real server.
+// Callbacks run on one timer thread, like the esp_timer task.
+
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool active;
+    int64_t due_us;
+    int64_t period_us;
+};
+
+namespace {
+
+class TimerThread {
+public:
+    // Never destroyed, the thread runs until the process exits
+    static TimerThread& GetInstance() {
+        static TimerThread* instance = new TimerThread();
+        return *instance;
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<esp_timer*> timers;
+
+private:
+    TimerThread() {
+        std::thread([this]() { Run(); }).detach();
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            esp_timer* next = nullptr;
+            for (auto timer : timers) {
+                if (timer->active && (next == nullptr || timer->due_us < next->due_us)) {
+                    next = timer;
+                }
+            }
+            if (next == nullptr) {
+                changed.wait(lock);
+                continue;
+            }
+            int64_t now = esp_timer_get_time();
+            if (next->due_us > now) {
+                changed.wait_for(lock, std::chrono::microseconds(next->due_us - now));
+                continue;
+            }
+            if (next->period_us == 0) {
+                next->active = false;
+            } else {
+                next->due_us += next->period_us;
+            }
+            auto callback = next->callback;
+            auto arg = next->arg;
+            lock.unlock();
+            callback(arg);
+            lock.lock();
+        }
+    }
+};
+
+}
+
+int64_t esp_timer_get_time() {
+    static auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+    auto& thread = TimerThread::GetInstance();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    auto timer = new esp_timer{create_args->callback, create_args->arg, false, 0, 0};
+    thread.timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t Start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    auto& thread = TimerThread::GetInstance();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (timer->active) {
+        return ESP_FAIL;
+    }
+    timer->active = true;
+    timer->due_us = esp_timer_get_time() + timeout_us;
+    timer->period_us = period_us;
+    thread.changed.notify_one();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return Start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return Start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    auto& thread = TimerThread::GetInstance();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (!timer->active) {
+        return ESP_FAIL;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    auto& thread = TimerThread::GetInstance();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.timers.erase(std::remove(thread.timers.begin(), thread.timers.end(), timer), thread.timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    auto& thread = TimerThread::GetInstance();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    return timer->active;
+}
+
+void HostAdvanceTime(int64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
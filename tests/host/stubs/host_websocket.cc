@@ -0,0 +1,266 @@
+#include "web_socket.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define TAG "WebSocket"
+
+static bool ReadExact(int fd, void* buffer, size_t len) {
+    auto p = static_cast<uint8_t*>(buffer);
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool WriteAll(int fd, const void* data, size_t len) {
+    auto p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+WebSocket::WebSocket() {
+}
+
+WebSocket::~WebSocket() {
+    Close();
+    if (receive_thread_.joinable()) {
+        // Deleted from its own callback, the thread finishes on its own
+        if (receive_thread_.get_id() == std::this_thread::get_id()) {
+            receive_thread_.detach();
+        } else {
+            receive_thread_.join();
+        }
+    }
+}
+
+void WebSocket::SetHeader(const char* key, const char* value) {
+    headers_[key] = value;
+}
+
+bool WebSocket::IsConnected() const {
+    return connected_;
+}
+
+bool WebSocket::Connect(const char* uri) {
+    std::string url = uri;
+    if (url.rfind("ws://", 0) != 0) {
+        ESP_LOGE(TAG, "Only ws:// is supported on the host: %s", uri);
+        return false;
+    }
+    url = url.substr(5);
+    auto slash = url.find('/');
+    std::string host_port = url.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : url.substr(slash);
+    auto colon = host_port.find(':');
+    std::string host = host_port.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : host_port.substr(colon + 1);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host.c_str());
+        return false;
+    }
+    fd_ = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd_ < 0 || connect(fd_, result->ai_addr, result->ai_addrlen) != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%s", host.c_str(), port.c_str());
+        freeaddrinfo(result);
+        Close();
+        return false;
+    }
+    freeaddrinfo(result);
+
+    // The server does not check the accept key against this one
+    std::string request = "GET " + path + " HTTP/1.1\r\n"
+        "Host: " + host_port + "\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n";
+    for (auto& header : headers_) {
+        request += header.first + ": " + header.second + "\r\n";
+    }
+    request += "\r\n";
+    if (!WriteAll(fd_, request.data(), request.size())) {
+        Close();
+        return false;
+    }
+
+    std::string response;
+    char c;
+    while (response.size() < 4 || response.compare(response.size() - 4, 4, "\r\n\r\n") != 0) {
+        if (!ReadExact(fd_, &c, 1) || response.size() > 8192) {
+            ESP_LOGE(TAG, "Upgrade response not received");
+            Close();
+            return false;
+        }
+        response += c;
+    }
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0) {
+        ESP_LOGE(TAG, "Upgrade refused: %s", response.substr(0, response.find('\r')).c_str());
+        Close();
+        return false;
+    }
+
+    connected_ = true;
+    receive_thread_ = std::thread([this]() { ReceiveLoop(); });
+    if (on_connected_) {
+        on_connected_();
+    }
+    return true;
+}
+
+bool WebSocket::Send(const std::string& data) {
+    return Send(data.data(), data.size(), false);
+}
+
+bool WebSocket::Send(const void* data, size_t len, bool binary, bool fin) {
+    return SendFrame(binary ? 0x2 : 0x1, data, len);
+}
+
+void WebSocket::Ping() {
+    SendFrame(0x9, nullptr, 0);
+}
+
+void WebSocket::Close() {
+    if (fd_ >= 0) {
+        // Normal closure
+        const uint8_t status[2] = {0x03, 0xe8};
+        SendFrame(0x8, status, sizeof(status));
+        connected_ = false;
+        shutdown(fd_, SHUT_RDWR);
+        if (!receive_thread_.joinable()) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+}
+
+void WebSocket::OnConnected(std::function<void()> callback) {
+    on_connected_ = callback;
+}
+
+void WebSocket::OnDisconnected(std::function<void()> callback) {
+    on_disconnected_ = callback;
+}
+
+void WebSocket::OnData(std::function<void(const char*, size_t, bool binary)> callback) {
+    on_data_ = callback;
+}
+
+void WebSocket::OnError(std::function<void(int)> callback) {
+    on_error_ = callback;
+}
+
+// Client frames are always masked
+bool WebSocket::SendFrame(int opcode, const void* data, size_t len) {
+    if (!connected_) {
+        return false;
+    }
+    thread_local std::mt19937 random(std::random_device{}());
+    std::vector<uint8_t> frame;
+    frame.reserve(len + 14);
+    frame.push_back(0x80 | opcode);
+    if (len < 126) {
+        frame.push_back(0x80 | len);
+    } else if (len < 65536) {
+        frame.push_back(0x80 | 126);
+        frame.push_back(len >> 8);
+        frame.push_back(len & 0xff);
+    } else {
+        frame.push_back(0x80 | 127);
+        for (int i = 7; i >= 0; i--) {
+            frame.push_back((uint64_t)len >> (i * 8));
+        }
+    }
+    uint32_t mask = random();
+    uint8_t mask_bytes[4];
+    memcpy(mask_bytes, &mask, 4);
+    frame.insert(frame.end(), mask_bytes, mask_bytes + 4);
+    auto payload = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; i++) {
+        frame.push_back(payload[i] ^ mask_bytes[i % 4]);
+    }
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    return WriteAll(fd_, frame.data(), frame.size());
+}
+
+void WebSocket::ReceiveLoop() {
+    std::vector<uint8_t> message;
+    bool message_binary = false;
+    while (true) {
+        uint8_t header[2];
+        if (!ReadExact(fd_, header, 2)) {
+            break;
+        }
+        int opcode = header[0] & 0x0f;
+        bool fin = header[0] & 0x80;
+        uint64_t len = header[1] & 0x7f;
+        if (len == 126) {
+            uint8_t ext[2];
+            if (!ReadExact(fd_, ext, 2)) {
+                break;
+            }
+            len = (ext[0] << 8) | ext[1];
+        } else if (len == 127) {
+            uint8_t ext[8];
+            if (!ReadExact(fd_, ext, 8)) {
+                break;
+            }
+            len = 0;
+            for (int i = 0; i < 8; i++) {
+                len = (len << 8) | ext[i];
+            }
+        }
+        std::vector<uint8_t> payload(len);
+        if (len > 0 && !ReadExact(fd_, payload.data(), len)) {
+            break;
+        }
+
+        if (opcode == 0x8) {
+            break;
+        } else if (opcode == 0x9) {
+            SendFrame(0xA, payload.data(), payload.size());
+            continue;
+        } else if (opcode == 0xA) {
+            continue;
+        }
+        if (opcode != 0x0) {
+            message.clear();
+            message_binary = opcode == 0x2;
+        }
+        message.insert(message.end(), payload.begin(), payload.end());
+        if (fin && on_data_) {
+            on_data_((const char*)message.data(), message.size(), message_binary);
+        }
+    }
+
+    connected_ = false;
+    close(fd_);
+    fd_ = -1;
+    if (on_disconnected_) {
+        on_disconnected_();
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// Defaults of main/Kconfig.projbuild for the modules built on the host.
+// Included into every source file, like the generated sdkconfig.h.
+#define CONFIG_UDP_REORDER_WINDOW_DEPTH 4
+#define CONFIG_UDP_REORDER_MAX_HOLD_MS 120
+#define CONFIG_AUDIO_BUFFER_POOL_SLOTS 32
+#define CONFIG_AUDIO_BUFFER_POOL_SLOT_SIZE 512
+#define CONFIG_JSON_ARENA_SIZE 4096
+#define CONFIG_AUDIO_AGGREGATION_LATENCY_BUDGET_MS 180
+#define CONFIG_HOUSEKEEPING_TIMER_SLACK_MS 500
+#define CONFIG_PROTOCOL_HEARTBEAT_INTERVAL_MS 1000
+#define CONFIG_PROTOCOL_HEARTBEAT_MAX_MISSES 2
+#define CONFIG_WEBSOCKET_URL "ws://127.0.0.1:8000/"
+#define CONFIG_WEBSOCKET_ACCESS_TOKEN "test-token"
+
+#endif // HOST_SDKCONFIG_H
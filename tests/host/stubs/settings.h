@@ -0,0 +1,52 @@
+#ifndef HOST_SETTINGS_H
+#define HOST_SETTINGS_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Settings kept in memory for the process instead of NVS
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) : ns_(ns) {}
+
+    std::string GetString(const std::string& key, const std::string& default_value = "") {
+        std::lock_guard<std::mutex> lock(Mutex());
+        auto it = Strings().find(ns_ + "." + key);
+        return it == Strings().end() ? default_value : it->second;
+    }
+
+    void SetString(const std::string& key, const std::string& value) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        Strings()[ns_ + "." + key] = value;
+    }
+
+    int32_t GetInt(const std::string& key, int32_t default_value = 0) {
+        auto value = GetString(key);
+        return value.empty() ? default_value : std::stoi(value);
+    }
+
+    void SetInt(const std::string& key, int32_t value) {
+        SetString(key, std::to_string(value));
+    }
+
+    void EraseKey(const std::string& key) {
+        std::lock_guard<std::mutex> lock(Mutex());
+        Strings().erase(ns_ + "." + key);
+    }
+
+private:
+    std::string ns_;
+
+    static std::mutex& Mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::map<std::string, std::string>& Strings() {
+        static std::map<std::string, std::string> strings;
+        return strings;
+    }
+};
+
+#endif // HOST_SETTINGS_H
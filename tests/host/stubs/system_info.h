@@ -0,0 +1,23 @@
+#ifndef HOST_SYSTEM_INFO_H
+#define HOST_SYSTEM_INFO_H
+
+#include <string>
+
+class SystemInfo {
+public:
+    // Per thread, so that simulated devices running side by side keep their identities
+    static std::string GetMacAddress() {
+        return MacAddress();
+    }
+    static void SetMacAddress(const std::string& mac_address) {
+        MacAddress() = mac_address;
+    }
+
+private:
+    static std::string& MacAddress() {
+        thread_local std::string mac_address = "02:00:00:00:00:01";
+        return mac_address;
+    }
+};
+
+#endif // HOST_SYSTEM_INFO_H
@@ -0,0 +1,47 @@
+#ifndef HOST_WEB_SOCKET_H
+#define HOST_WEB_SOCKET_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Host version of the esp-ml307 WebSocket over a POSIX socket, ws:// only.
+// The callbacks run on a receive thread, like on the receive task of the
+// component.
+class WebSocket {
+public:
+    WebSocket();
+    ~WebSocket();
+
+    void SetHeader(const char* key, const char* value);
+    bool IsConnected() const;
+    bool Connect(const char* uri);
+    bool Send(const std::string& data);
+    bool Send(const void* data, size_t len, bool binary = false, bool fin = true);
+    void Ping();
+    void Close();
+
+    void OnConnected(std::function<void()> callback);
+    void OnDisconnected(std::function<void()> callback);
+    void OnData(std::function<void(const char*, size_t, bool binary)> callback);
+    void OnError(std::function<void(int)> callback);
+
+private:
+    int fd_ = -1;
+    std::atomic<bool> connected_{false};
+    std::mutex send_mutex_;
+    std::thread receive_thread_;
+    std::map<std::string, std::string> headers_;
+    std::function<void()> on_connected_;
+    std::function<void()> on_disconnected_;
+    std::function<void(const char*, size_t, bool)> on_data_;
+    std::function<void(int)> on_error_;
+
+    bool SendFrame(int opcode, const void* data, size_t len);
+    void ReceiveLoop();
+};
+
+#endif // HOST_WEB_SOCKET_H
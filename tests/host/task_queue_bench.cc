@@ -0,0 +1,166 @@
+// Checks that the main loop task queue never drops a task and keeps the order
+// of every producer when it overflows, then compares scheduling through a
+// mutex-guarded std::list<std::function>, as Application::Schedule did before,
+// against SpillingTaskQueue: operations per second and heap allocations per
+// task, with several producer threads and one consumer like the main loop.
+// The producers outrun the consumer, so most tasks take the spill path.
+
+#include "task_queue.h"
+#include "alloc_counter.h"
+#include "expect.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PRODUCER_COUNT 3
+#define TASKS_PER_PRODUCER 300000
+
+// Same storage as the firmware MainTask
+using Task = InlineTask<2 * sizeof(void*) + sizeof(std::string)>;
+
+// A tiny queue and a consumer that sleeps now and then, so most tasks spill
+static void TestOverflowKeepsOrder() {
+    static SpillingTaskQueue<Task, 16> queue;
+    const int kTasks = 20000;
+    std::vector<int> next(PRODUCER_COUNT, 0);
+    int out_of_order = 0;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < kTasks; i++) {
+                queue.Push(Task([&, p, i]() {
+                    if (next[p] != i) {
+                        out_of_order++;
+                    }
+                    next[p] = i + 1;
+                }));
+            }
+        });
+    }
+
+    Task task;
+    int ran = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (ran < PRODUCER_COUNT * kTasks && std::chrono::steady_clock::now() < deadline) {
+        if (!queue.TryPop(task)) {
+            std::this_thread::yield();
+            continue;
+        }
+        task();
+        task.Reset();
+        if (++ran % 1000 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    printf("overflow: %d of %d tasks ran, %lu spilled, %d out of order\n", ran, PRODUCER_COUNT * kTasks,
+        (unsigned long)queue.spill_count(), out_of_order);
+    if (ran != PRODUCER_COUNT * kTasks || out_of_order != 0 || queue.spill_count() == 0 || queue.TryPop(task)) {
+        fprintf(stderr, "tasks were lost, repeated or reordered\n");
+        expect_failures++;
+    }
+}
+
+template <typename Run>
+static void Measure(const char* name, Run run) {
+    auto allocs = GetAllocCount();
+    auto start = std::chrono::steady_clock::now();
+    run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto end_allocs = GetAllocCount();
+    const double total = PRODUCER_COUNT * TASKS_PER_PRODUCER;
+    printf("%-14s %12.0f ops/s %8.2f allocs/task\n", name, total / seconds,
+        double(end_allocs.allocations - allocs.allocations) / total);
+}
+
+static void RunListQueue(long& sum) {
+    std::mutex mutex;
+    std::list<std::function<void()>> tasks;
+    std::atomic<int> done{0};
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < TASKS_PER_PRODUCER; i++) {
+                uint32_t timestamp = i;
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back([&sum, timestamp]() { sum += timestamp; });
+            }
+            done++;
+        });
+    }
+
+    // The main loop of the time took the whole list under the lock
+    while (true) {
+        bool finished = done == PRODUCER_COUNT;
+        std::list<std::function<void()>> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch = std::move(tasks);
+        }
+        for (auto& task : batch) {
+            task();
+        }
+        if (finished && batch.empty()) {
+            break;
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+}
+
+static void RunSpillingQueue(long& sum) {
+    static SpillingTaskQueue<Task, 128> queue;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < TASKS_PER_PRODUCER; i++) {
+                uint32_t timestamp = i;
+                queue.Push(Task([&sum, timestamp]() { sum += timestamp; }));
+            }
+        });
+    }
+
+    Task task;
+    for (long ran = 0; ran < (long)PRODUCER_COUNT * TASKS_PER_PRODUCER;) {
+        if (queue.TryPop(task)) {
+            task();
+            task.Reset();
+            ran++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    printf("%-14s max depth %zu/%zu, %lu spilled\n", "", queue.max_depth(), queue.capacity(),
+        (unsigned long)queue.spill_count());
+}
+
+int main() {
+    TestOverflowKeepsOrder();
+
+    long list_sum = 0;
+    long queue_sum = 0;
+    Measure("list+mutex", [&]() { RunListQueue(list_sum); });
+    Measure("SpillingQueue", [&]() { RunSpillingQueue(queue_sum); });
+    if (list_sum != queue_sum) {
+        fprintf(stderr, "sums differ: %ld %ld\n", list_sum, queue_sum);
+        expect_failures++;
+    }
+
+    return ExpectResult();
+}
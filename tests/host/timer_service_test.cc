@@ -0,0 +1,100 @@
+// Checks that TimerService keeps short timers within a quarter of their
+// period although they were created with a longer slack, that Delete waits
+// for a callback that is running on another task, and that a callback that
+// fell due does not run once its timer was deleted.
+
+#include "timer_service.h"
+#include "expect.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// A 200 ms heartbeat next to a 300 ms timer, both created with 500 ms slack.
+// Unclamped, the first wake-up would be put off until the second timer is due.
+static void TestSlackIsClamped() {
+    auto& service = TimerService::GetInstance();
+    struct Timer {
+        int64_t period_us;
+        int64_t start_us;
+        int fired;
+        int64_t max_late_us;
+    };
+    Timer timers[2] = {{200000, 0, 0, 0}, {300000, 0, 0, 0}};
+    TimerId ids[2];
+    for (int i = 0; i < 2; i++) {
+        auto& timer = timers[i];
+        ids[i] = service.Create("clamped", 500, [&timer]() {
+            timer.fired++;
+            int64_t late = esp_timer_get_time() - (timer.start_us + timer.fired * timer.period_us);
+            timer.max_late_us = std::max(timer.max_late_us, late);
+        });
+        timer.start_us = esp_timer_get_time();
+        service.StartPeriodic(ids[i], timer.period_us / 1000);
+    }
+
+    HostAdvanceTime(3000000);
+    for (int i = 0; i < 2; i++) {
+        printf("period %lld ms: %d runs, max %lld ms late\n", timers[i].period_us / 1000, timers[i].fired,
+            timers[i].max_late_us / 1000);
+        EXPECT(timers[i].fired == 3000000 / timers[i].period_us);
+        EXPECT(timers[i].max_late_us <= timers[i].period_us / 4);
+        service.Delete(ids[i]);
+    }
+}
+
+static void TestDeleteWaitsForCallback() {
+    auto& service = TimerService::GetInstance();
+    std::atomic<bool> started{false};
+    std::atomic<bool> finished{false};
+    auto id = service.Create("slow", 0, [&]() {
+        started = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        finished = true;
+    });
+    service.StartOnce(id, 10);
+
+    // Stands in for the esp_timer task
+    std::thread timer_task([]() {
+        HostAdvanceTime(20000);
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    service.Delete(id);
+    EXPECT(finished);
+    timer_task.join();
+}
+
+static void TestDeleteFromCallbacks() {
+    auto& service = TimerService::GetInstance();
+    int self_runs = 0;
+    int second_runs = 0;
+    TimerId self = 0;
+    TimerId second = 0;
+    // Must not wait for itself
+    self = service.Create("self", 0, [&]() {
+        self_runs++;
+        service.Delete(self);
+        service.Delete(second);
+    });
+    second = service.Create("second", 0, [&]() {
+        second_runs++;
+    });
+    service.StartOnce(self, 10);
+    service.StartOnce(second, 10);
+
+    HostAdvanceTime(20000);
+    EXPECT(self_runs == 1);
+    EXPECT(second_runs == 0);
+}
+
+int main() {
+    TestSlackIsClamped();
+    TestDeleteWaitsForCallback();
+    TestDeleteFromCallbacks();
+
+    return ExpectResult();
+}
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""Runs a command against the stand-in server on a free local port.
+
+    with_stand_in_server.py <stand_in_server.py> [server options] -- <command> [args]
+
+The command gets --url ws://127.0.0.1:<port>/ appended. Exits with the exit
+code of the command.
+"""
+import socket
+import subprocess
+import sys
+import threading
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def main():
+    args = sys.argv[1:]
+    if "--" not in args:
+        print(__doc__, file=sys.stderr)
+        return 2
+    split = args.index("--")
+    server_args, command = args[:split], args[split + 1:]
+    port = free_port()
+    server = subprocess.Popen(
+        [sys.executable, *server_args, "--host", "127.0.0.1", "--port", str(port)],
+        stdout=subprocess.PIPE, text=True)
+    try:
+        # The server prints its address once it accepts connections
+        for line in server.stdout:
+            if line.startswith("listening on"):
+                break
+        else:
+            print("stand-in server did not start", file=sys.stderr)
+            return 1
+        # Keep the log of the server, and its pipe from filling up
+        threading.Thread(target=lambda: sys.stdout.writelines(server.stdout), daemon=True).start()
+        return subprocess.call(command + ["--url", f"ws://127.0.0.1:{port}/"])
+    finally:
+        server.terminate()
+        server.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())